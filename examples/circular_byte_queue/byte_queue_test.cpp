@@ -0,0 +1,119 @@
+// byte_queue_test.cpp : Tests circular_byte_queue and circular_byte_queue_mp with variable-length records.
+//
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <cstring>
+#include <circular_byte_queue_mp.h>
+#include "../example_check.h"
+
+struct record
+{
+	// producer id
+	unsigned id;
+	// monotonic increasing value
+	unsigned val;
+	// payload bytes, a function of val
+	uint8_t fill[40];
+};
+
+constexpr unsigned MESSAGES = 100000;
+const unsigned PRODUCER_THREAD_CNT = 3;
+
+// The payload size varies from record to record, so the records wrap at varying offsets.
+size_t payload_size(const unsigned val)
+{
+	return offsetof(record, fill) + val % sizeof(record::fill);
+}
+
+record make_record(const unsigned id, const unsigned val)
+{
+	record r;
+	r.id = id;
+	r.val = val;
+	memset(r.fill, static_cast<int>(val & 0xff), sizeof(r.fill));
+	return r;
+}
+
+bool valid(const record& r, const size_t size)
+{
+	if (size != payload_size(r.val)) return false;
+	for (size_t i = 0; i < size - offsetof(record, fill); ++i) if (r.fill[i] != (r.val & 0xff)) return false;
+	return true;
+}
+
+void test_full_empty_wrap()
+{
+	circular_byte_queue queue(100);
+	check(queue.capacity() == 128, "capacity is rounded up to a power of two");
+	check(queue.max_record_size() == 56, "max record size is half the capacity less the length word");
+	record r;
+	check(queue.empty() && queue.pop(&r, sizeof(r)) == ~static_cast<size_t>(0), "empty queue pops nothing");
+	check(!queue.push(&r, queue.max_record_size() + 1), "oversized record is rejected");
+	for (unsigned val = 0; val < 1000; ++val)
+	{
+		const record in = make_record(0, val);
+		check(queue.push(&in, payload_size(val)), "push into drained queue");
+		// Fill up the queue, then drain it.
+		unsigned pushed = 1;
+		while (queue.push(&in, payload_size(val))) ++pushed;
+		for (unsigned i = 0; i < pushed; ++i)
+		{
+			record out;
+			const auto size = queue.pop(&out, sizeof(out));
+			check(size == payload_size(val) && valid(out, size) && out.val == val, "pop across wraparound");
+		}
+		check(queue.empty(), "drained queue is empty");
+	}
+	// In-place access.
+	uint8_t* const payload = queue.reserve_write(3);
+	check(payload != nullptr, "reserve_write");
+	memcpy(payload, "abc", 3);
+	queue.commit_write(3);
+	const auto span = queue.reserve_read();
+	check(span.size == 3 && !memcmp(span.data, "abc", 3), "reserve_read sees the committed record");
+	queue.commit_read();
+	check(queue.empty(), "commit_read removes the record");
+}
+
+void test_threads()
+{
+	circular_byte_queue_mp queue(1024);
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < PRODUCER_THREAD_CNT; ++i)
+	{
+		threads.emplace_back([&queue, i]() {
+			for (unsigned c = 0; c < MESSAGES; ++c)
+			{
+				const record r = make_record(i, c);
+				while (!queue.push(&r, payload_size(c))) std::this_thread::yield();
+			}
+			});
+	}
+	std::vector<unsigned> next(PRODUCER_THREAD_CNT);
+	for (unsigned received = 0; received < PRODUCER_THREAD_CNT * MESSAGES;)
+	{
+		record r;
+		const auto size = queue.pop(&r, sizeof(r));
+		if (size == ~static_cast<size_t>(0))
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		check(valid(r, size), "record payload is intact");
+		check(r.id < PRODUCER_THREAD_CNT && r.val == next[r.id], "per producer order");
+		if (r.id < PRODUCER_THREAD_CNT) next[r.id] = r.val + 1;
+		++received;
+	}
+	for (auto& thread : threads) thread.join();
+	check(queue.empty(), "queue is drained");
+}
+
+int main()
+{
+	test_full_empty_wrap();
+	test_threads();
+	return test_result("byte queue");
+}
@@ -0,0 +1,321 @@
+// circular_queue_test.cpp : Tests circular_queue, the single-producer, single-consumer queue.
+//
+
+#include <iostream>
+#include <thread>
+#include <utility>
+#include <circular_queue.h>
+#include "../example_check.h"
+
+// An element that counts its constructions and destructions, and that is not
+// default-constructible. Destroying an element twice, or one that was never
+// constructed, is counted as a bad destruction.
+struct tracked
+{
+	static int live;
+	static int bad;
+	static const unsigned ALIVE = 0x600d;
+	static const unsigned DEAD = 0xdead;
+
+	explicit tracked(const int v) : val(v), state(ALIVE) { ++live; }
+	tracked(const tracked& other) : val(other.val), state(ALIVE) { ++live; }
+	tracked(tracked&& other) : val(other.val), state(ALIVE) { other.val = -1; ++live; }
+	tracked& operator=(const tracked& other) { val = other.val; return *this; }
+	tracked& operator=(tracked&& other) { val = other.val; other.val = -1; return *this; }
+	~tracked()
+	{
+		if (state != ALIVE) ++bad;
+		state = DEAD;
+		--live;
+	}
+
+	int val;
+	unsigned state;
+};
+int tracked::live = 0;
+int tracked::bad = 0;
+
+// pop(), peek() and pushpeek() default-construct elements.
+struct tracked_default : tracked
+{
+	tracked_default() : tracked(0) {}
+	explicit tracked_default(const int v) : tracked(v) {}
+};
+
+template< typename T, typename Queue >
+void fill(Queue& queue, const int first, const int count)
+{
+	for (int i = first; i < first + count; ++i) check(queue.push(T(i)), "push");
+}
+
+void test_lifetime_no_default()
+{
+	{
+		circular_queue<tracked> queue(4);
+		check(!tracked::live, "a queue constructs no elements up front");
+		fill<tracked>(queue, 1, 3);
+		check(tracked::live == 3, "push constructs one element each");
+		const tracked val(4);
+		check(queue.push(val) && !queue.push(val) && tracked::live == 5, "a rejected push constructs nothing");
+		tracked out[2] = { tracked(0), tracked(0) };
+		check(queue.pop_n(out, 2) == 2 && out[0].val == 1 && out[1].val == 2 && tracked::live == 5, "pop_n destroys the popped elements");
+		int sum = 0;
+		check(queue.consume(1, [&sum](tracked& element) { sum += element.val; }) == 1 && sum == 3 && tracked::live == 4,
+			"consume destroys the consumed elements");
+		fill<tracked>(queue, 5, 3);
+		check(queue.available() == 4 && tracked::live == 7, "push across the wrap");
+		// Resize with the elements wrapped around the end of the ring buffer.
+		check(queue.capacity(6) && queue.capacity() == 6 && tracked::live == 7, "resize relocates the elements");
+		check(queue.pop_n(out, 1) == 1 && out[0].val == 4, "resize preserves the order");
+		check(!queue.capacity(2) && tracked::live == 6, "a failed resize keeps the elements");
+		queue.flush();
+		check(!queue.available() && tracked::live == 3, "flush destroys the elements");
+		fill<tracked>(queue, 1, 6);
+		check(tracked::live == 9, "refill");
+	}
+	check(!tracked::live, "queue destruction destroys the elements");
+	check(!tracked::bad, "every element is destroyed exactly once");
+}
+
+template< typename Queue >
+void test_lifetime_default(Queue& queue)
+{
+	// The pending elements of the queues of the previous calls are still alive.
+	const int base = tracked::live;
+	fill<tracked_default>(queue, 1, 2);
+	check(queue.pop().val == 1, "pop");
+	check(tracked::live - base == 1, "pop destroys the popped element");
+	check(queue.peek().val == 2, "peek");
+	check(tracked::live - base == 1, "peek leaves the element");
+	queue.pushpeek().val = 3;
+	check(tracked::live - base == 2 && queue.push() && tracked::live - base == 2, "push releases the pushpeek element");
+	queue.pushpeek().val = 4;
+	check(queue.push(tracked_default(5)), "push");
+	check(tracked::live - base == 3, "push discards a pending pushpeek element");
+	queue.pushpeek().val = 6;
+	check(tracked::live - base == 4, "pushpeek constructs a pending element");
+	queue.flush();
+	check(tracked::live - base == 1, "flush keeps the pending element");
+	check(queue.push() && queue.pop().val == 6, "push the pending element after flush");
+	check(tracked::live == base, "drained");
+	queue.pushpeek();
+}
+
+template< typename Queue >
+void test_move(Queue& queue)
+{
+	fill<tracked_default>(queue, 1, 3);
+	check(queue.pop().val == 1, "pop");
+	fill<tracked_default>(queue, 4, 1);
+	queue.pushpeek().val = 5;
+	check(tracked::live == 4, "elements and a pending element");
+	Queue moved(std::move(queue));
+	check(!queue.available() && moved.available() == 3 && tracked::live == 4, "move construction leaves the queue empty");
+	check(moved.push() && moved.available() == 4 && tracked::live == 4, "the pending element moves along");
+	Queue assigned(4);
+	fill<tracked_default>(assigned, 10, 2);
+	assigned = std::move(moved);
+	check(!moved.available() && tracked::live == 4, "move assignment destroys the replaced elements");
+	for (int i = 2; i <= 5; ++i) check(assigned.pop().val == i, "move preserves the order");
+	check(!assigned.available() && !tracked::live, "drained");
+}
+
+// The fixed capacity queue relocates the elements of its embedded ring buffer on move.
+template< size_t N >
+struct fixed_queue : circular_queue<tracked_default, void, N>
+{
+	fixed_queue() = default;
+	explicit fixed_queue(size_t) {}
+	fixed_queue(fixed_queue&&) = default;
+	fixed_queue& operator=(fixed_queue&&) = default;
+};
+
+// The producer and the consumer only re-read the other side's index when the queue
+// looks full or empty from their cached copy of it.
+void test_cached_indices()
+{
+	circular_queue<int> queue(3);
+	for (int round = 0; round < 5; ++round)
+	{
+		for (int i = 0; i < 3; ++i) check(queue.push(round * 3 + i), "push into free slot");
+		check(!queue.push(-1) && !queue.available_for_push(), "push into full queue fails");
+		check(queue.pop() == round * 3, "pop");
+		check(queue.push(round * 3 + 3), "push re-reads the consumer index when the queue looks full");
+		for (int i = 1; i <= 3; ++i) check(queue.pop() == round * 3 + i, "pop in FIFO order across wraparound");
+		check(!queue.pop() && !queue.available(), "pop from empty queue fails");
+		check(queue.push(7), "push");
+		check(queue.pop() == 7, "pop re-reads the producer index when the queue looks empty");
+	}
+	int out[3];
+	check(queue.push_n(out, 0) == 0 && queue.pop_n(out, 3) == 0, "empty block");
+	const int block[4] = { 1, 2, 3, 4 };
+	check(queue.push_n(block, 4) == 3 && queue.push_n(block, 1) == 0, "push_n into full queue");
+	check(queue.pop_n(out, 1) == 1 && queue.push_n(block + 3, 1) == 1, "push_n re-reads the consumer index");
+	check(queue.pop_n(out, 3) == 3 && out[0] == 2 && out[2] == 4, "pop_n in FIFO order");
+}
+
+// A fixed power-of-two capacity masks the free-running indices into the ring buffer, and keeps
+// the pending pushpeek() element in the extra slot at index N. Any other fixed capacity wraps
+// the indices at the ring buffer size of N + 1, like a capacity set at runtime.
+template< typename Queue >
+void test_capacity(Queue& queue, const size_t capacity)
+{
+	const int cap = static_cast<int>(capacity);
+	check(queue.capacity() == capacity && queue.available_for_push() == capacity, "capacity");
+	for (int round = 0; round < 2 * cap + 1; ++round)
+	{
+		// Start every lap at a different offset in the ring buffer.
+		check(queue.push(-1) && queue.pop() == -1, "advance by one");
+		for (int i = 0; i < cap; ++i) check(queue.push(round * 100 + i), "push into free slot");
+		// The pending element of a full queue must not overwrite an element.
+		queue.pushpeek() = -2;
+		check(!queue.push() && queue.available() == capacity, "push into full queue fails");
+		check(queue.pushpeek() == -2, "the pending element survives a failed push");
+		for (int i = 0; i < cap; ++i) check(queue.peek() == round * 100 + i && queue.pop() == round * 100 + i, "pop in FIFO order across wraparound");
+		check(queue.push() && queue.pop() == -2 && !queue.available(), "push the pending element");
+	}
+	int block[16];
+	for (int i = 0; i < 16; ++i) block[i] = i;
+	for (int round = 0; round < 2 * cap + 1; ++round)
+	{
+		check(queue.push(-1) && queue.pop() == -1, "advance by one");
+		check(queue.push_n(block, 16) == capacity && !queue.available_for_push(), "push_n up to the capacity");
+		int out[16];
+		check(queue.pop_n(out, 16) == capacity && out[0] == 0 && out[cap - 1] == cap - 1, "pop_n across wraparound");
+	}
+}
+
+template< size_t N >
+void test_fixed_capacity()
+{
+	circular_queue<int, void, N> queue;
+	check(queue.capacity(N) && !queue.capacity(N + 1) && queue.capacity() == N, "fixed capacity cannot be resized");
+	test_capacity(queue, N);
+	check(sizeof(queue) >= (N + 1) * sizeof(int), "the ring buffer is embedded");
+}
+
+void test_sequence()
+{
+	circular_queue<int, void, 4> queue;
+	for (int i = 0; i < 10; ++i) check(queue.push(i) && queue.pop() == i, "push and pop");
+	check(queue.push(10) && queue.push_sequence() == 11 && queue.pop_sequence() == 10, "masked indices run freely");
+}
+
+// Fill the reserved spans with consecutive values starting at first.
+template< typename Spans >
+int fill_spans(const Spans& elements, int first)
+{
+	for (size_t i = 0; i < elements.first.size; ++i) elements.first.data[i] = first++;
+	for (size_t i = 0; i < elements.second.size; ++i) elements.second.data[i] = first++;
+	return first;
+}
+
+template< typename Queue, typename... Args >
+void test_spans(const Args&... args)
+{
+	const size_t capacity = Queue(args...).capacity();
+	size_t wrapped = 0;
+	for (size_t offset = 0; offset <= capacity; ++offset)
+	{
+		Queue queue(args...);
+		for (size_t i = 0; i < offset; ++i) queue.push(-1);
+		queue.pop_n(nullptr, offset);
+		auto elements = queue.reserve_write(capacity + 1);
+		check(elements.size() == capacity, "reserve_write is limited to the free elements");
+		check(!elements.second.size || elements.second.data < elements.first.data, "the second span starts at the beginning of the ring buffer");
+		// Nothing is pushed until commit_write(), and uncommitted elements are not published.
+		fill_spans(elements, 0);
+		check(!queue.available(), "reserve_write pushes nothing");
+		queue.commit_write(capacity - 1);
+		check(queue.available() == capacity - 1, "commit_write publishes k elements");
+		elements = queue.reserve_write(2);
+		check(elements.size() == 1, "reserve_write of the remaining free element");
+		fill_spans(elements, static_cast<int>(capacity) - 1);
+		queue.commit_write(1);
+		// Read the elements in place, across the wrap.
+		auto read = queue.reserve_read(capacity);
+		check(read.size() == capacity && queue.available() == capacity, "reserve_read pops nothing");
+		if (read.second.size) ++wrapped;
+		int expected = 0;
+		bool ordered = true;
+		for (size_t i = 0; i < read.first.size; ++i) ordered = ordered && read.first.data[i] == expected++;
+		for (size_t i = 0; i < read.second.size; ++i) ordered = ordered && read.second.data[i] == expected++;
+		check(ordered, "the spans hold the elements in queue order");
+		queue.commit_read(2);
+		check(queue.available() == capacity - 2 && queue.peek() == 2, "commit_read pops k elements");
+		// consume() visits the elements in place, in batches of up to max.
+		int next = 2;
+		size_t consumed = 0;
+		while (const size_t n = queue.consume(3, [&next, &ordered](int& element) { ordered = ordered && element == next++; }))
+		{
+			check(n <= 3, "consume is limited to max");
+			consumed += n;
+		}
+		check(ordered && consumed == capacity - 2 && !queue.available(), "consume in FIFO order across wraparound");
+		check(!queue.consume(3, [](int&) {}) && !queue.reserve_read(1).size(), "nothing to consume");
+	}
+	check(wrapped == capacity - 1, "the spans wrap at every offset but the ring buffer start");
+}
+
+void test_threads()
+{
+	const unsigned MESSAGES = 200000;
+	circular_queue<unsigned> queue(61);
+	std::thread producer([&queue]() {
+		for (unsigned c = 1; c <= MESSAGES;)
+		{
+			const unsigned block[3] = { c, c + 1, c + 2 };
+			const size_t pushed = c % 2 ? queue.push(c) : queue.push_n(block, min(3u, MESSAGES + 1 - c));
+			if (!pushed) std::this_thread::yield();
+			c += static_cast<unsigned>(pushed);
+		}
+		});
+	for (unsigned next = 1; next <= MESSAGES;)
+	{
+		unsigned block[5];
+		const size_t popped = next % 3 ? queue.pop_n(block, 5) : (block[0] = queue.pop()) != 0;
+		if (!popped) std::this_thread::yield();
+		for (size_t k = 0; k < popped; ++k)
+		{
+			check(block[k] == next, "FIFO order between producer and consumer");
+			next = block[k] + 1;
+		}
+	}
+	producer.join();
+	check(!queue.available(), "queue is drained");
+}
+
+int main()
+{
+	test_lifetime_no_default();
+	{
+		circular_queue<tracked_default> queue(4);
+		test_lifetime_default(queue);
+		fixed_queue<4> masked;
+		test_lifetime_default(masked);
+		fixed_queue<5> unmasked;
+		test_lifetime_default(unmasked);
+	}
+	check(!tracked::live, "queue destruction destroys the pending elements");
+	{
+		circular_queue<tracked_default> queue(4);
+		test_move(queue);
+		fixed_queue<4> masked;
+		test_move(masked);
+		fixed_queue<5> unmasked;
+		test_move(unmasked);
+	}
+	check(!tracked::live && !tracked::bad, "every element is destroyed exactly once");
+	test_cached_indices();
+	test_threads();
+	circular_queue<int> queue(5);
+	test_capacity(queue, 5);
+	test_fixed_capacity<1>();
+	test_fixed_capacity<4>();
+	test_fixed_capacity<5>();
+	test_fixed_capacity<8>();
+	test_sequence();
+	test_spans<circular_queue<int>>(6);
+	test_spans<circular_queue<int, void, 8>>();
+	return test_result("circular_queue");
+}
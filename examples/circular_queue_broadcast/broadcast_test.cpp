@@ -0,0 +1,83 @@
+// broadcast_test.cpp : Tests circular_queue_broadcast, in which every consumer sees every element.
+//
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <circular_queue_broadcast.h>
+#include "../example_check.h"
+
+constexpr unsigned MESSAGES = 200000;
+const unsigned CONSUMER_THREAD_CNT = 3;
+
+void test_gating_and_wrap()
+{
+	circular_queue_broadcast<int> queue(3, 2);
+	check(queue.capacity() == 4 && queue.consumers() == 2, "capacity is rounded up to a power of two");
+	check(queue.pop(0) == 0 && !queue.available(1), "empty ring pops default value");
+	for (int round = 0; round < 5; ++round)
+	{
+		for (int i = 1; i <= 4; ++i) check(queue.push(round * 10 + i), "push into free slot");
+		check(!queue.push(99) && !queue.available_for_push(), "push into full ring fails");
+		// The faster consumer does not free slots that the slower one has yet to read.
+		for (int i = 1; i <= 4; ++i) check(queue.pop(0) == round * 10 + i, "first consumer sees every element");
+		check(!queue.available(0) && queue.available(1) == 4, "consumers read independently");
+		check(!queue.push(99), "producer is gated by the slowest consumer");
+		check(queue.peek(1) == round * 10 + 1, "peek at the slower consumer's next element");
+		int next = round * 10;
+		check(queue.consume(1, 2, [&next](const int& element) { check(element == ++next, "visit in place"); }) == 2,
+			"second consumer reads a batch");
+		check(queue.available_for_push() == 2, "the batch frees its slots");
+		check(queue.pop(1) == round * 10 + 3 && queue.pop(1) == round * 10 + 4, "second consumer sees every element");
+	}
+}
+
+void test_destruction()
+{
+	// Elements are destroyed as their slots are reused, and with the ring.
+	circular_queue_broadcast<std::string> queue(2, 1);
+	for (int i = 0; i < 10; ++i)
+	{
+		check(queue.push(std::string(100, static_cast<char>('a' + i))), "push string");
+		check(queue.pop(0) == std::string(100, static_cast<char>('a' + i)), "pop string");
+	}
+	check(queue.push(std::string(100, 'z')), "leave an element in the ring");
+}
+
+void test_threads()
+{
+	circular_queue_broadcast<unsigned> queue(256, CONSUMER_THREAD_CNT);
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < CONSUMER_THREAD_CNT; ++i)
+	{
+		threads.emplace_back([&queue, i]() {
+			unsigned next = 0;
+			while (next < MESSAGES)
+			{
+				const auto n = queue.consume(i, 16, [&next](const unsigned& val)
+					{
+						check(val == next, "every consumer sees every element in order");
+						next = val + 1;
+					});
+				if (!n) std::this_thread::yield();
+			}
+			});
+	}
+	for (unsigned c = 0; c < MESSAGES;)
+	{
+		if (queue.push(c)) ++c;
+		else std::this_thread::yield();
+	}
+	for (auto& thread : threads) thread.join();
+	for (unsigned i = 0; i < CONSUMER_THREAD_CNT; ++i) check(!queue.available(i), "every consumer is drained");
+}
+
+int main()
+{
+	test_gating_and_wrap();
+	test_destruction();
+	test_threads();
+	return test_result("broadcast");
+}
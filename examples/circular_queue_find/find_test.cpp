@@ -0,0 +1,103 @@
+// find_test.cpp : Tests find() and find_any() of circular_queue on bytes, which are scanned
+// with SIMD instructions where available. Build it with and without -mavx2, to cover
+// both the 32 and the 16 byte chunks.
+//
+
+#include <iostream>
+#include <cstring>
+#include <vector>
+#include <circular_queue.h>
+#include "../example_check.h"
+
+const uint8_t FILLER = 0x20;
+const uint8_t DELIMITERS[12] = { '\n', '\r', ';', ',', '|', ':', '\t', '#', '!', '?', '&', '$' };
+// 1 delimiter scans one needle, 8 fill all SIMD needles, 12 fall back to the scalar scan.
+const size_t DELIMITER_COUNTS[] = { 1, 3, 8, 9, 12 };
+
+void test_chunk_boundaries()
+{
+	uint8_t data[100];
+	for (const size_t count : DELIMITER_COUNTS)
+	{
+		// A match at every position, so on either side of each 16 and 32 byte chunk boundary,
+		// and within the scalar tail, for every length of the data.
+		for (size_t size = 0; size <= sizeof(data); ++size)
+		{
+			memset(data, FILLER, sizeof(data));
+			check(detail::find_any(data, size, DELIMITERS, count) == size, "no match in filler");
+			for (size_t pos = 0; pos < size; ++pos)
+			{
+				memset(data, FILLER, sizeof(data));
+				data[pos] = DELIMITERS[pos % count];
+				// Bytes that are not among the delimiters do not match, nor does any byte past the data.
+				if (count < sizeof(DELIMITERS) && size > 1) data[(pos + 1) % size] = DELIMITERS[count];
+				data[size < sizeof(data) ? size : pos] = DELIMITERS[0];
+				if (detail::find_any(data, size, DELIMITERS, count) != pos)
+				{
+					check(false, "match at every position");
+					std::cerr << "  count " << count << " size " << size << " pos " << pos << std::endl;
+				}
+				// A second match later in the data does not hide the first one.
+				if (pos + 40 < size) data[pos + 40] = DELIMITERS[0];
+				check(detail::find_any(data, size, DELIMITERS, count) == pos, "first of two matches");
+			}
+		}
+	}
+	check(detail::find_any(data, sizeof(data), DELIMITERS, 0) == sizeof(data), "no delimiters match nothing");
+	const char text[] = "key=value;next";
+	check(detail::find_any(text, sizeof(text) - 1, ";=", 2) == 3, "char overload");
+}
+
+template< typename Queue >
+void test_queue_wrap(Queue& queue)
+{
+	const size_t capacity = queue.capacity();
+	std::vector<uint8_t> data(capacity);
+	// Start the elements at every offset in the ring buffer, and put the match at every position,
+	// so that it is found before, at, and just past the wrap point.
+	for (size_t offset = 0; offset <= capacity; ++offset)
+	{
+		for (const size_t count : DELIMITER_COUNTS)
+		{
+			for (size_t pos = 0; pos < capacity; ++pos)
+			{
+				queue.flush();
+				for (size_t i = 0; i < offset; ++i) queue.push(FILLER);
+				queue.pop_n(nullptr, offset);
+				std::fill(data.begin(), data.end(), FILLER);
+				data[pos] = DELIMITERS[count - 1];
+				check(queue.push_n(data.data(), capacity) == capacity, "fill queue");
+				if (queue.find_any(DELIMITERS, count) != pos)
+				{
+					check(false, "find_any across the wrap");
+					std::cerr << "  offset " << offset << " count " << count << " pos " << pos << std::endl;
+				}
+			}
+		}
+		queue.flush();
+		for (size_t i = 0; i < offset; ++i) queue.push(FILLER);
+		queue.pop_n(nullptr, offset);
+		std::fill(data.begin(), data.end(), FILLER);
+		queue.push_n(data.data(), capacity);
+		check(queue.find_any(DELIMITERS, 12) == Queue::npos, "no match across the wrap");
+		check(queue.find('\n') == Queue::npos, "find no match across the wrap");
+	}
+	queue.flush();
+	check(queue.find('\n') == Queue::npos, "empty queue has no match");
+	queue.push('a');
+	queue.push('\n');
+	queue.push('\n');
+	check(queue.find('\n') == 1, "find the first match");
+	check(queue.pop_n(nullptr, queue.find('\n') + 1) == 2 && queue.find('\n') == 0, "pop up to and including the match");
+}
+
+int main()
+{
+	test_chunk_boundaries();
+	// The runtime capacity wraps at 101 bytes, the fixed power-of-two capacity is masked at 64.
+	circular_queue<uint8_t> queue(100);
+	test_queue_wrap(queue);
+	circular_queue<uint8_t, void, 64> fixed;
+	test_queue_wrap(fixed);
+	return test_result("find");
+}
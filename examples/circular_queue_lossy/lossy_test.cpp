@@ -0,0 +1,129 @@
+// lossy_test.cpp : Tests circular_queue_lossy, which overwrites the oldest elements when full.
+//
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <circular_queue_lossy.h>
+#include "../example_check.h"
+
+struct qitem
+{
+	// producer id
+	unsigned id;
+	// monotonic increasing value
+	unsigned val;
+};
+
+constexpr unsigned MESSAGES = 200000;
+const unsigned PRODUCER_THREAD_CNT = 3;
+
+void test_full_empty_wrap()
+{
+	circular_queue_lossy<int> queue(3);
+	check(queue.capacity() == 4, "capacity is rounded up to a power of two");
+	int val = 0;
+	size_t seq = 0;
+	check(!queue.pop(val) && !queue.available(), "empty queue pops nothing");
+	for (int round = 0; round < 5; ++round)
+	{
+		for (int i = 0; i < 4; ++i) check(queue.push(round * 4 + i) == static_cast<size_t>(round * 4 + i), "push returns its sequence number");
+		check(queue.available() == 4, "full queue has capacity available");
+		for (int i = 0; i < 4; ++i) check(queue.pop(val, seq) && val == round * 4 + i && seq == static_cast<size_t>(val), "pop in FIFO order across wraparound");
+		check(!queue.pop(val), "drained queue is empty");
+	}
+	check(!queue.lost(), "nothing lost without overrun");
+
+	// Overrun: the oldest elements are overwritten, and counted as lost.
+	for (int i = 0; i < 10; ++i) queue.push(100 + i);
+	check(queue.available() == 4, "overrun queue holds capacity elements");
+	check(queue.pop(val, seq) && val == 106, "pop skips the overwritten elements");
+	check(queue.lost() == 6, "overwritten elements are counted as lost");
+	queue.flush();
+	check(!queue.available() && !queue.pop(val), "flushed queue is empty");
+}
+
+// Exposes the slots, to stall a push as if its producer were preempted mid-write.
+struct lossy_probe : circular_queue_lossy<int>
+{
+	lossy_probe() : circular_queue_lossy<int>(4) {}
+	void stall(const size_t pos)
+	{
+		m_buffer[pos & m_mask].seq.store(2 * pos + 1);
+	}
+	void finish(const size_t pos)
+	{
+		m_buffer[pos & m_mask].seq.store(2 * pos + 2);
+	}
+};
+
+void test_lapped_write()
+{
+	lossy_probe queue;
+	int val = 0;
+	size_t seq = 0;
+	for (int i = 0; i < 4; ++i) queue.push(i);
+	// The write of element 0 is still in progress when push 4 laps it.
+	queue.stall(0);
+	check(queue.push(4) == 4, "push over a slot still being written returns without waiting");
+	check(queue.pop(val, seq) && val == 1 && seq == 1, "pop skips the lapped element");
+	check(queue.pop(val) && val == 2 && queue.pop(val) && val == 3, "pop the elements before the dropped push");
+	check(!queue.pop(val) && queue.lost() == 2, "dropped push is counted as lost");
+	queue.finish(0);
+	check(queue.push(5) == 5 && queue.push(6) == 6, "push after the stalled write completes");
+	check(queue.pop(val, seq) && val == 5 && seq == 5, "pop after the dropped push");
+	// A push whose own write is in progress is not yet lost.
+	queue.stall(6);
+	check(!queue.pop(val) && queue.lost() == 2, "element still being written is not popped");
+	queue.finish(6);
+	check(queue.pop(val, seq) && val == 6 && seq == 6 && !queue.pop(val), "pop the completed element");
+}
+
+void test_threads()
+{
+	circular_queue_lossy<qitem> queue(256);
+	std::atomic<unsigned> done{ 0 };
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < PRODUCER_THREAD_CNT; ++i)
+	{
+		threads.emplace_back([&queue, &done, i]() {
+			for (unsigned c = 0; c < MESSAGES; ++c)
+			{
+				queue.push({ i, c });
+				if (!(c % 64)) std::this_thread::yield();
+			}
+			++done;
+			});
+	}
+	// Elements arrive in increasing sequence and per producer order, with gaps for the lost ones.
+	std::vector<unsigned> next(PRODUCER_THREAD_CNT);
+	size_t popped = 0;
+	size_t last = 0;
+	qitem item;
+	size_t seq;
+	for (;;)
+	{
+		const bool finished = done.load() == PRODUCER_THREAD_CNT;
+		if (queue.pop(item, seq))
+		{
+			check(!popped || seq > last, "increasing sequence numbers");
+			check(item.id < PRODUCER_THREAD_CNT && item.val >= next[item.id], "per producer order");
+			next[item.id] = item.val + 1;
+			last = seq;
+			++popped;
+		}
+		else if (finished) break;
+		else std::this_thread::yield();
+	}
+	for (auto& thread : threads) thread.join();
+	check(popped + queue.lost() == PRODUCER_THREAD_CNT * MESSAGES, "every element is popped or counted lost");
+}
+
+int main()
+{
+	test_full_empty_wrap();
+	test_lapped_write();
+	test_threads();
+	return test_result("lossy");
+}
@@ -5,6 +5,7 @@
 #include <thread>
 #include <chrono>
 #include <vector>
+#define CIRCULAR_QUEUE_WAIT 1
 #include <circular_queue_mp.h>
 
 struct qitem
@@ -30,34 +31,23 @@ int main()
 	for (int i = 0; i < threads.capacity(); ++i)
 	{
 		threads.push(std::thread([i]() {
-			for (int c = 0; c < MESSAGES;)
+			for (int c = 0; c < MESSAGES; ++c)
 			{
 				// simulate some load
 				auto start = std::chrono::system_clock::now();
 				while (std::chrono::system_clock::now() - start < 1us);
-				if (queue.push({ i, c }))
-				{
-					++c;
-				}
-				else
-				{
-					//std::cerr << "queue full" << std::endl;
-					//std::this_thread::sleep_for(10us);
-				}
+				queue.push_wait({ i, c });
 				//if (0 == c % 10000) std::this_thread::sleep_for(10us);
 			}
 			}));
 	}
 	for (int o = 0; o < threads.available() * MESSAGES; ++o)
 	{
-		auto now = std::chrono::system_clock::now();
-		while (!queue.available())
+		qitem item;
+		while (!queue.pop_wait_for(item, 20s))
 		{
-			auto starvedFor = std::chrono::system_clock::now() - now;
-			if (starvedFor > 20s) std::cerr << "queue starved for > 20s" << std::endl;
-			//std::this_thread::sleep_for(20ms);
+			std::cerr << "queue starved for > 20s" << std::endl;
 		}
-		auto item = queue.pop();
 		if (checks[item.id] != item.val)
 		{
 			std::cerr << "item mismatch" << std::endl;
@@ -0,0 +1,120 @@
+// mpmc_test.cpp : Tests circular_queue_mpmc with multiple producers and multiple consumers.
+//
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <circular_queue_mpmc.h>
+#include "../example_check.h"
+
+struct qitem
+{
+	// producer id
+	unsigned id;
+	// monotonic increasing value
+	unsigned val = 0;
+};
+
+constexpr unsigned MESSAGES = 200000;
+const unsigned PRODUCER_THREAD_CNT = 3;
+const unsigned CONSUMER_THREAD_CNT = 3;
+
+void test_full_empty_wrap()
+{
+	circular_queue_mpmc<int> queue(3);
+	check(queue.capacity() == 4, "capacity is rounded up to a power of two");
+	check(queue.pop() == 0 && !queue.available(), "empty queue pops default value");
+	for (int round = 0; round < 5; ++round)
+	{
+		for (int i = 1; i <= 4; ++i) check(queue.push(round * 10 + i), "push into free slot");
+		check(!queue.push(99), "push into full queue fails");
+		check(queue.available() == 4, "full queue has capacity available");
+		for (int i = 1; i <= 4; ++i) check(queue.pop() == round * 10 + i, "pop in FIFO order across wraparound");
+		check(!queue.available(), "drained queue is empty");
+	}
+}
+
+// A consumer that claimed a batch and is still visiting it holds its slots, although
+// another consumer has popped all later elements. push_n must not reuse these slots.
+void test_push_n_behind_slow_consumer()
+{
+	circular_queue_mpmc<int> queue(4);
+	const int block[4] = { 1, 2, 3, 4 };
+	check(queue.push_n(block, 4) == 4, "push_n fills the queue");
+	const int overwrite[4] = { 101, 102, 103, 104 };
+	int visits = 0;
+	check(queue.consume(2, [&](int& element)
+		{
+			if (!visits++)
+			{
+				check(queue.consume(2, [](int&) {}) == 2, "second consumer takes the later elements");
+				check(!queue.push_n(overwrite, 4), "push_n does not reuse slots still being visited");
+			}
+			check(element == visits, "element being visited is not overwritten");
+		}) == 2, "first consumer claims a batch");
+	check(queue.push_n(overwrite, 4) == 4, "all slots are free after the visit");
+	int element;
+	for (int i = 0; i < 4; ++i) check(queue.try_pop(element) && element == overwrite[i], "pushed elements follow in order");
+	check(!queue.try_pop(element), "queue is drained");
+	check(queue.push_n(block, 4) == 4 && queue.pop_n(nullptr, 4) == 4, "discarding pop_n");
+}
+
+void test_threads()
+{
+	circular_queue_mpmc<qitem> queue(1024);
+	std::atomic<unsigned> total_rx{ 0 };
+	std::vector<std::atomic<unsigned>> sums(PRODUCER_THREAD_CNT);
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < PRODUCER_THREAD_CNT; ++i)
+	{
+		threads.emplace_back([&queue, i]() {
+			for (unsigned c = 0; c < MESSAGES;)
+			{
+				if (c % 2)
+				{
+					if (queue.push({ i, c })) ++c;
+					else std::this_thread::yield();
+				}
+				else
+				{
+					const qitem items[2] = { { i, c }, { i, c + 1 } };
+					const auto pushed = queue.push_n(items, c + 1 < MESSAGES ? 2 : 1);
+					if (!pushed) std::this_thread::yield();
+					c += static_cast<unsigned>(pushed);
+				}
+			}
+			});
+	}
+	for (unsigned i = 0; i < CONSUMER_THREAD_CNT; ++i)
+	{
+		threads.emplace_back([&]() {
+			// Each consumer sees the elements of each producer in increasing order.
+			std::vector<unsigned> next(PRODUCER_THREAD_CNT);
+			std::vector<bool> seen(PRODUCER_THREAD_CNT);
+			while (total_rx.load() < PRODUCER_THREAD_CNT * MESSAGES)
+			{
+				const auto n = queue.consume(4, [&](qitem& item)
+					{
+						check(!seen[item.id] || item.val >= next[item.id], "per producer order");
+						seen[item.id] = true;
+						next[item.id] = item.val + 1;
+						sums[item.id] += 1;
+					});
+				if (n) total_rx += static_cast<unsigned>(n);
+				else std::this_thread::yield();
+			}
+			});
+	}
+	for (auto& thread : threads) thread.join();
+	for (unsigned i = 0; i < PRODUCER_THREAD_CNT; ++i) check(sums[i] == MESSAGES, "every element popped exactly once");
+	check(!queue.available(), "queue is drained");
+}
+
+int main()
+{
+	test_full_empty_wrap();
+	test_push_n_behind_slow_consumer();
+	test_threads();
+	return test_result("mpmc");
+}
@@ -0,0 +1,125 @@
+// mpsc_test.cpp : Tests circular_queue_mpsc with multiple producers and a single consumer.
+//
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <circular_queue_mpsc.h>
+#include "../example_check.h"
+
+struct qitem
+{
+	// producer id
+	unsigned id;
+	// monotonic increasing value
+	unsigned val = 0;
+};
+
+constexpr unsigned MESSAGES = 200000;
+const unsigned PRODUCER_THREAD_CNT = 3;
+
+void test_full_empty_wrap()
+{
+	circular_queue_mpsc<int> queue(3);
+	check(queue.capacity() == 4, "capacity is rounded up to a power of two");
+	check(queue.pop() == 0 && queue.peek() == 0 && !queue.available(), "empty queue pops default value");
+	for (int round = 0; round < 5; ++round)
+	{
+		const int block[3] = { round * 10 + 2, round * 10 + 3, round * 10 + 4 };
+		check(queue.push(round * 10 + 1), "push into free slot");
+		check(queue.push_n(block, 3) == 3, "push_n into free slots");
+		check(!queue.push(99) && !queue.push_n(block, 3) && !queue.available_for_push(), "push into full queue fails");
+		check(queue.available() == 4 && queue.peek() == round * 10 + 1, "peek at first element");
+		int out[3];
+		check(queue.pop_n(out, 3) == 3 && out[0] == round * 10 + 1 && out[2] == round * 10 + 3, "pop_n in FIFO order across wraparound");
+		check(queue.push_n(block, 3) == 3, "push_n across wraparound");
+		check(queue.pop() == round * 10 + 4, "pop in FIFO order");
+		check(queue.pop_n(nullptr, 4) == 3 && !queue.available(), "discarding pop_n drains the queue");
+	}
+}
+
+// The consumer frees each slot of a batch before it advances its index past the batch,
+// so producers can claim freed slots before the index tells that they are free.
+void test_push_during_batch()
+{
+	circular_queue_mpsc<int> queue(4);
+	for (int i = 1; i <= 4; ++i) check(queue.push(i), "fill the queue");
+	int visits = 0;
+	check(queue.consume(4, [&queue, &visits](int& element)
+		{
+			check(element == ++visits, "batch in FIFO order");
+			if (visits == 2)
+			{
+				check(queue.push(5), "push into a slot freed by the batch");
+				check(queue.available() <= queue.capacity(), "available() does not exceed the capacity");
+				check(queue.available_for_push() <= queue.capacity(), "available_for_push() does not wrap around");
+			}
+		}) == 4, "consume the batch");
+	check(queue.available() == 1 && queue.pop() == 5, "element pushed during the batch");
+}
+
+void test_non_trivial()
+{
+	circular_queue_mpsc<std::string> queue(4);
+	for (int i = 0; i < 4; ++i) check(queue.push(std::string(100, static_cast<char>('a' + i))), "push string");
+	check(queue.pop() == std::string(100, 'a'), "pop string");
+	std::string joined;
+	queue.for_each([&joined](std::string&& s) { joined += s[0]; });
+	check(joined == "bcd" && !queue.available(), "for_each drains the queue");
+	check(queue.push("x") && queue.push("y"), "push after drain");
+	queue.flush();
+	check(!queue.available() && queue.push("z") && queue.pop() == "z", "flush discards all elements");
+	// Elements left in the queue are destroyed with it.
+	check(queue.push(std::string(100, 'q')), "leave an element in the queue");
+}
+
+void test_threads()
+{
+	circular_queue_mpsc<qitem> queue(1024);
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < PRODUCER_THREAD_CNT; ++i)
+	{
+		threads.emplace_back([&queue, i]() {
+			for (unsigned c = 0; c < MESSAGES;)
+			{
+				if (c % 2)
+				{
+					if (queue.push({ i, c })) ++c;
+					else std::this_thread::yield();
+				}
+				else
+				{
+					const qitem items[2] = { { i, c }, { i, c + 1 } };
+					const auto pushed = queue.push_n(items, c + 1 < MESSAGES ? 2 : 1);
+					if (!pushed) std::this_thread::yield();
+					c += static_cast<unsigned>(pushed);
+				}
+			}
+			});
+	}
+	std::vector<unsigned> next(PRODUCER_THREAD_CNT);
+	for (unsigned rx = 0; rx < PRODUCER_THREAD_CNT * MESSAGES;)
+	{
+		const auto n = queue.consume(16, [&next](qitem& item)
+			{
+				check(item.id < PRODUCER_THREAD_CNT && item.val == next[item.id], "per producer order");
+				next[item.id] = item.val + 1;
+			});
+		if (!n) std::this_thread::yield();
+		check(queue.available_for_push() <= queue.capacity(), "available_for_push() does not wrap around");
+		rx += static_cast<unsigned>(n);
+	}
+	for (auto& thread : threads) thread.join();
+	check(!queue.available(), "queue is drained");
+}
+
+int main()
+{
+	test_full_empty_wrap();
+	test_push_during_batch();
+	test_non_trivial();
+	test_threads();
+	return test_result("mpsc");
+}
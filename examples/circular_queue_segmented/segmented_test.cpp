@@ -0,0 +1,72 @@
+// segmented_test.cpp : Tests circular_queue_segmented, which grows by linking segments.
+//
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <circular_queue_segmented.h>
+#include "../example_check.h"
+
+constexpr unsigned MESSAGES = 1000000;
+
+void test_grow_and_drain()
+{
+	circular_queue_segmented<int, 4, 2> queue;
+	check(queue.pop() == 0 && !queue.available(), "empty queue pops default value");
+	for (int round = 0; round < 3; ++round)
+	{
+		// Grows across many segments, then reuses the cached ones.
+		for (int i = 1; i <= 1000; ++i) check(queue.push(i), "push never finds the queue full");
+		check(queue.available() == 1000, "all elements are available");
+		for (int i = 1; i <= 1000; ++i) check(queue.pop() == i, "pop in FIFO order across segments");
+		check(queue.pop() == 0 && !queue.available(), "drained queue is empty");
+	}
+	// Alternating push and pop wraps around within a segment.
+	for (int i = 1; i <= 100; ++i) check(queue.push(i) && queue.pop() == i && !queue.available(), "wraparound within a segment");
+}
+
+void test_move_only()
+{
+	// Elements left in the queue are destroyed with it.
+	circular_queue_segmented<std::unique_ptr<int>, 8> queue;
+	for (int i = 0; i < 100; ++i) check(queue.push(std::unique_ptr<int>(new int(i))), "push move-only element");
+	for (int i = 0; i < 50; ++i)
+	{
+		const auto element = queue.pop();
+		check(element && *element == i, "pop move-only element");
+	}
+}
+
+void test_threads()
+{
+	circular_queue_segmented<unsigned, 64> queue;
+	std::thread producer([&queue]() {
+		for (unsigned c = 1; c <= MESSAGES; ++c)
+		{
+			check(queue.push(c), "push never finds the queue full");
+			if (!(c % 4096)) std::this_thread::yield();
+		}
+		});
+	for (unsigned next = 1; next <= MESSAGES;)
+	{
+		const auto val = queue.pop();
+		if (!val)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		check(val == next, "FIFO order");
+		next = val + 1;
+	}
+	producer.join();
+	check(!queue.available(), "queue is drained");
+}
+
+int main()
+{
+	test_grow_and_drain();
+	test_move_only();
+	test_threads();
+	return test_result("segmented");
+}
@@ -0,0 +1,122 @@
+// sharded_test.cpp : Tests circular_queue_sharded with a lane per producer thread.
+//
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <new>
+#include <circular_queue_sharded.h>
+#include "../example_check.h"
+
+struct qitem
+{
+	// producer id
+	unsigned id;
+	// monotonic increasing value
+	unsigned val = 0;
+};
+
+constexpr unsigned MESSAGES = 100000;
+const unsigned PRODUCER_THREAD_CNT = 3;
+
+void test_full_empty_wrap()
+{
+	circular_queue_sharded<int> queue(4, 2);
+	check(queue.pop() == 0 && !queue.available() && !queue.lanes(), "empty queue pops default value");
+	for (int round = 0; round < 5; ++round)
+	{
+		for (int i = 1; i <= 4; ++i) check(queue.push(round * 10 + i), "push into lane");
+		check(!queue.push(99), "push into full lane fails");
+		check(queue.lanes() == 1 && queue.available() == 4, "one lane for one thread");
+		int out[4];
+		check(queue.pop_n(out, 4) == 4, "pop_n");
+		for (int i = 0; i < 4; ++i) check(out[i] == round * 10 + i + 1, "pop in FIFO order across wraparound");
+		check(!queue.available(), "drained queue is empty");
+	}
+}
+
+void test_lane_limit_and_reuse()
+{
+	circular_queue_sharded<int> queue(4, 2);
+	check(queue.push(1), "push from main thread");
+	std::thread([&queue]() { check(queue.push(2), "push from second thread"); }).join();
+	check(queue.lanes() == 2, "two lanes");
+	// The lane of the exited thread is taken over by the next one, with its element.
+	std::thread([&queue]() { check(queue.push(3), "push into released lane"); }).join();
+	check(queue.lanes() == 2 && queue.available() == 3, "released lane is reused");
+	std::thread t1([&queue]() {
+		check(queue.push(4), "push into released lane");
+		std::thread([&queue]() { check(!queue.push(5), "no lane left"); }).join();
+		});
+	t1.join();
+	int sum = 0;
+	while (queue.available()) sum += queue.pop();
+	check(sum == 1 + 2 + 3 + 4, "all elements popped");
+}
+
+void test_failed_allocation()
+{
+	// The lane buffer cannot be allocated.
+	circular_queue_sharded<int> queue(static_cast<size_t>(1) << 50, 2);
+	for (int i = 0; i < 3; ++i)
+	{
+		try
+		{
+			check(!queue.push(1), "push without lane fails");
+		}
+		catch (const std::bad_alloc&)
+		{
+		}
+	}
+	check(!queue.lanes(), "failed allocations claim no lanes");
+}
+
+void test_ordered()
+{
+	circular_queue_sharded<int, true> queue(8, 3);
+	check(queue.push(1), "push from main thread");
+	std::thread([&queue]() { check(queue.push(2) && queue.push(3), "push from second thread"); }).join();
+	check(queue.push(4), "push from main thread");
+	for (int i = 1; i <= 4; ++i) check(queue.pop() == i, "pop in time stamp order");
+	check(!queue.available(), "drained queue is empty");
+}
+
+void test_threads()
+{
+	circular_queue_sharded<qitem> queue(256, PRODUCER_THREAD_CNT);
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < PRODUCER_THREAD_CNT; ++i)
+	{
+		threads.emplace_back([&queue, i]() {
+			for (unsigned c = 0; c < MESSAGES;)
+			{
+				if (queue.push({ i, c })) ++c;
+				else std::this_thread::yield();
+			}
+			});
+	}
+	std::vector<unsigned> next(PRODUCER_THREAD_CNT);
+	for (unsigned rx = 0; rx < PRODUCER_THREAD_CNT * MESSAGES;)
+	{
+		const auto n = queue.consume(16, [&next](qitem&& item)
+			{
+				check(item.id < PRODUCER_THREAD_CNT && item.val == next[item.id], "per producer order");
+				next[item.id] = item.val + 1;
+			});
+		if (!n) std::this_thread::yield();
+		rx += static_cast<unsigned>(n);
+	}
+	for (auto& thread : threads) thread.join();
+	check(queue.lanes() == PRODUCER_THREAD_CNT && !queue.available(), "queue is drained");
+}
+
+int main()
+{
+	test_full_empty_wrap();
+	test_lane_limit_and_reuse();
+	test_failed_allocation();
+	test_ordered();
+	test_threads();
+	return test_result("sharded");
+}
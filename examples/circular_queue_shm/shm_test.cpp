@@ -0,0 +1,152 @@
+// shm_test.cpp : Tests circular_queue_shm and circular_queue_mp_shm in a shared mapping,
+// with producers in threads and in a forked process.
+//
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <circular_queue_shm.h>
+#include "../example_check.h"
+
+struct qitem
+{
+	// producer id
+	unsigned id;
+	// monotonic increasing value
+	unsigned val;
+};
+
+constexpr unsigned MESSAGES = 100000;
+const unsigned PRODUCER_THREAD_CNT = 3;
+
+void* map_region(const size_t size)
+{
+	void* region = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	return region == MAP_FAILED ? nullptr : region;
+}
+
+void test_create_attach()
+{
+	const auto size = circular_queue_shm<int>::region_size(4);
+	void* region = map_region(size);
+	check(region != nullptr, "mmap");
+	circular_queue_shm<int> producer;
+	circular_queue_shm<int> consumer;
+	check(!consumer.attach(region, size), "attach before create fails");
+	check(!producer.create(static_cast<char*>(region) + 1, size - 1), "create in misaligned region fails");
+	check(producer.create(region, size) && producer.capacity() == 4, "create");
+	check(consumer.attach(region, size) && consumer.capacity() == 4, "attach");
+	circular_queue_shm<long double> other;
+	check(!other.attach(region, size), "attach with different element size fails");
+	// A process of another layout version, or with another size_t, must not attach.
+	auto header = static_cast<detail::circular_queue_shm_header*>(region);
+	++header->version;
+	check(!other.attach(region, size) && !circular_queue_shm<int>().attach(region, size), "attach to another layout version fails");
+	--header->version;
+	header->indexSize = 4 + 8 - sizeof(size_t);
+	check(!circular_queue_shm<int>().attach(region, size), "attach with different index size fails");
+	header->indexSize = sizeof(size_t);
+	check(consumer.pop() == 0 && !consumer.available(), "empty queue pops default value");
+	for (int round = 0; round < 5; ++round)
+	{
+		const int block[3] = { round * 10 + 2, round * 10 + 3, round * 10 + 4 };
+		check(producer.push(round * 10 + 1), "push into free slot");
+		check(producer.push_n(block, 3) == 3, "push_n into free slots");
+		check(!producer.push(99) && !producer.available_for_push(), "push into full queue fails");
+		check(consumer.peek() == round * 10 + 1, "peek at first element");
+		int out[4];
+		check(consumer.pop_n(out, 3) == 3, "pop_n");
+		check(out[0] == round * 10 + 1 && out[2] == round * 10 + 3, "pop_n in FIFO order across wraparound");
+		check(consumer.pop() == round * 10 + 4 && !consumer.available(), "pop the last element");
+	}
+	producer.detach();
+	check(!producer.attached() && consumer.attached(), "detach leaves the queue to the other side");
+	munmap(region, size);
+}
+
+void test_threads()
+{
+	const auto size = circular_queue_mp_shm<qitem>::region_size(256);
+	void* region = map_region(size);
+	circular_queue_mp_shm<qitem> queue;
+	check(region && queue.create(region, size), "create");
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < PRODUCER_THREAD_CNT; ++i)
+	{
+		threads.emplace_back([region, size, i]() {
+			circular_queue_mp_shm<qitem> producer;
+			check(producer.attach(region, size), "attach producer");
+			for (unsigned c = 0; c < MESSAGES;)
+			{
+				const qitem items[2] = { { i, c }, { i, c + 1 } };
+				const auto pushed = producer.push_n(items, c % 3 || c + 1 == MESSAGES ? 1 : 2);
+				if (!pushed) std::this_thread::yield();
+				c += static_cast<unsigned>(pushed);
+			}
+			});
+	}
+	std::vector<unsigned> next(PRODUCER_THREAD_CNT);
+	for (unsigned rx = 0; rx < PRODUCER_THREAD_CNT * MESSAGES;)
+	{
+		qitem items[8];
+		const auto n = queue.pop_n(items, 8);
+		if (!n) std::this_thread::yield();
+		for (size_t k = 0; k < n; ++k)
+		{
+			check(items[k].id < PRODUCER_THREAD_CNT && items[k].val == next[items[k].id], "per producer order");
+			next[items[k].id] = items[k].val + 1;
+		}
+		rx += static_cast<unsigned>(n);
+	}
+	for (auto& thread : threads) thread.join();
+	check(!queue.available(), "queue is drained");
+	munmap(region, size);
+}
+
+void test_process()
+{
+	const auto size = circular_queue_mp_shm<qitem>::region_size(64);
+	void* region = map_region(size);
+	circular_queue_mp_shm<qitem> queue;
+	check(region && queue.create(region, size), "create");
+	const pid_t child = fork();
+	if (!child)
+	{
+		circular_queue_mp_shm<qitem> producer;
+		if (!producer.attach(region, size)) _exit(1);
+		for (unsigned c = 0; c < MESSAGES;)
+		{
+			if (producer.push({ 1, c })) ++c;
+			else std::this_thread::yield();
+		}
+		_exit(0);
+	}
+	check(child > 0, "fork");
+	unsigned next = 0;
+	while (child > 0 && next < MESSAGES)
+	{
+		if (!queue.available())
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		const qitem item = queue.pop();
+		check(item.id == 1 && item.val == next, "order across processes");
+		next = item.val + 1;
+	}
+	int status = 0;
+	check(child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && !WEXITSTATUS(status), "producer process");
+	munmap(region, size);
+}
+
+int main()
+{
+	test_create_attach();
+	test_threads();
+	test_process();
+	return test_result("shm");
+}
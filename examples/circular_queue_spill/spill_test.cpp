@@ -0,0 +1,93 @@
+// spill_test.cpp : Tests circular_queue_mp_spill, which spills to a file when its ring buffer is full.
+//
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <circular_queue_spill.h>
+#include "../example_check.h"
+
+struct qitem
+{
+	// producer id
+	unsigned id;
+	// monotonic increasing value
+	unsigned val;
+};
+
+constexpr unsigned MESSAGES = 200000;
+const unsigned PRODUCER_THREAD_CNT = 3;
+
+void test_spill_and_drain()
+{
+	circular_queue_mp_spill<int> queue(4);
+	for (int i = 1; i <= 4; ++i) check(queue.push(i), "push into ring buffer");
+	check(!queue.push(5), "push into full ring buffer without spill file fails");
+	check(queue.open("spill_test.bin"), "open spill file");
+	for (int i = 5; i <= 300000; ++i) check(queue.push(i), "push into spill file");
+	check(queue.spilled() == 300000 - 4 && queue.available() == 300000, "spilled elements are available");
+	for (int i = 1; i <= 300000; ++i) check(queue.pop() == i, "pop in FIFO order from ring buffer and spill file");
+	check(queue.pop() == 0 && !queue.available(), "drained queue is empty");
+	check(queue.push(7) && !queue.spilled() && queue.pop() == 7, "ring buffer takes over after the spill file is drained");
+	// The file is reused after draining it.
+	for (int i = 1; i <= 100; ++i) check(queue.push(i), "push after drain");
+	check(queue.spilled() == 96, "spill again");
+	for (int i = 1; i <= 100; ++i) check(queue.pop() == i, "pop in FIFO order after drain");
+}
+
+void test_size_limit()
+{
+	circular_queue_mp_spill<int> queue(4);
+	const size_t maxSize = 2 * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	const int limit = static_cast<int>(maxSize / sizeof(int));
+	check(queue.open("spill_test.bin", maxSize), "open spill file");
+	int pushed = 0;
+	while (queue.push(pushed + 1)) ++pushed;
+	check(pushed == 4 + limit, "pushes beyond the size limit are rejected");
+	check(queue.spilled() == static_cast<size_t>(limit), "spill file is full");
+	int popped = 0;
+	for (int i = 0; i < 5; ++i) check(queue.pop() == ++popped, "pop from ring buffer and spill file");
+	check(queue.push(++pushed), "read part of the full spill file is reused");
+	check(!queue.push(pushed + 1), "spill file is full again");
+	for (int i = 0; i < limit / 2; ++i) check(queue.pop() == ++popped, "pop half of the spill file");
+	for (int i = 0; i < limit / 2; ++i) check(queue.push(++pushed), "push after popping half of the spill file");
+	while (popped < pushed) check(queue.pop() == ++popped, "pop in FIFO order across compaction");
+	check(queue.pop() == 0 && !queue.available(), "drained queue is empty");
+}
+
+void test_threads()
+{
+	circular_queue_mp_spill<qitem> queue(64);
+	check(queue.open("spill_test.bin"), "open spill file");
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < PRODUCER_THREAD_CNT; ++i)
+	{
+		threads.emplace_back([&queue, i]() {
+			for (unsigned c = 1; c <= MESSAGES; ++c) check(queue.push({ i, c }), "push never fails while spilling");
+			});
+	}
+	std::vector<unsigned> last(PRODUCER_THREAD_CNT);
+	for (unsigned rx = 0; rx < PRODUCER_THREAD_CNT * MESSAGES;)
+	{
+		const qitem item = queue.pop();
+		if (!item.val)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		check(item.id < PRODUCER_THREAD_CNT && item.val == last[item.id] + 1, "per producer order");
+		last[item.id] = item.val;
+		++rx;
+	}
+	for (auto& thread : threads) thread.join();
+	check(!queue.pop().val, "queue is drained");
+}
+
+int main()
+{
+	test_spill_and_drain();
+	test_size_limit();
+	test_threads();
+	return test_result("spill");
+}
@@ -0,0 +1,124 @@
+// codel_test.cpp : Tests the sojourn times and the codel policy of circular_queue_mp_sojourn and ghostl::async_queue_sojourn.
+//
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <circular_queue_codel.h>
+#include <async_queue.h>
+#include <run_task.h>
+#include "../example_check.h"
+
+using namespace std::chrono_literals;
+
+// Sojourn times above 1 ms for 5 ms start dropping.
+const codel policy(1000, 5000);
+const codel rejecting_policy(1000, 5000, true);
+constexpr unsigned MESSAGES = 100000;
+
+void test_circular_queue_sojourn()
+{
+	// Without a policy, stale elements report their sojourn time, but are not dropped.
+	circular_queue_mp_sojourn<int> queue(8);
+	for (int i = 1; i <= 3; ++i) check(queue.push(i), "push");
+	std::this_thread::sleep_for(20ms);
+	check(queue.pop() == 1 && queue.sojourn() >= 20000, "sojourn time of a stale element");
+	std::this_thread::sleep_for(10ms);
+	check(queue.pop() == 2 && queue.pop() == 3 && !queue.dropped(), "stale elements are not dropped");
+	check(!queue.policy().dropping() && queue.push(4), "push is never rejected");
+}
+
+void test_circular_queue_dropping()
+{
+	circular_queue_mp_codel<int> queue(8, policy);
+	check(queue.pop() == 0, "empty queue pops default value");
+	for (int i = 1; i <= 3; ++i) check(queue.push(i), "push");
+	std::this_thread::sleep_for(20ms);
+	check(queue.pop() == 1 && queue.sojourn() >= 20000, "first stale element starts the interval");
+	std::this_thread::sleep_for(10ms);
+	check(queue.pop() == 3, "stale element after the interval is dropped");
+	check(queue.dropped() == 1 && !queue.policy().dropping(), "the empty queue ends dropping");
+	for (int i = 1; i <= 2; ++i) check(queue.push(i), "push");
+	check(queue.pop() == 1 && queue.pop() == 2 && queue.dropped() == 1, "fresh elements are not dropped");
+}
+
+void test_circular_queue_rejecting()
+{
+	circular_queue_mp_codel<int> queue(8, rejecting_policy);
+	for (int i = 1; i <= 3; ++i) check(queue.push(i), "push");
+	std::this_thread::sleep_for(20ms);
+	check(queue.pop() == 1, "first stale element starts the interval");
+	std::this_thread::sleep_for(10ms);
+	check(queue.pop() == 2 && queue.policy().rejecting(), "stale element after the interval starts rejecting");
+	check(!queue.push(4), "push is rejected");
+	check(queue.pop() == 3 && !queue.policy().rejecting(), "the empty queue ends rejecting");
+	check(queue.push(5) && queue.pop() == 5 && !queue.dropped(), "push is accepted again");
+}
+
+void test_async_queue_sojourn()
+{
+	ghostl::async_queue_sojourn<int> queue;
+	for (int i = 1; i <= 3; ++i) check(queue.push(i), "push");
+	std::this_thread::sleep_for(20ms);
+	check(queue.pop().resume() == 1 && queue.sojourn() >= 20000, "sojourn time of a stale item");
+	std::this_thread::sleep_for(10ms);
+	check(queue.pop().resume() == 2 && queue.pop().resume() == 3 && !queue.dropped(), "stale items are not dropped");
+}
+
+void test_async_queue_dropping()
+{
+	ghostl::async_queue_codel<int> queue(policy);
+	for (int i = 1; i <= 3; ++i) check(queue.push(i), "push");
+	std::this_thread::sleep_for(20ms);
+	check(queue.pop().resume() == 1, "first stale item starts the interval");
+	std::this_thread::sleep_for(10ms);
+	check(queue.pop().resume() == 3, "stale item after the interval is dropped");
+	check(queue.dropped() == 1, "one item dropped");
+	check(queue.push(4), "push");
+	std::this_thread::sleep_for(10ms);
+	// Were dropping not ended by the empty queue, this stale item would be dropped,
+	// and pop() would wait for the next one.
+	auto pop = queue.pop();
+	check(pop.resume() == 4 && queue.dropped() == 1, "the last item of the queue is not dropped");
+}
+
+ghostl::async_queue_codel<unsigned> async_queue(policy);
+unsigned received = 0;
+
+auto run_consumer() -> ghostl::task<>
+{
+	unsigned next = 0;
+	while (next < MESSAGES)
+	{
+		const auto item = co_await async_queue.pop();
+		check(item >= next, "order");
+		next = item + 1;
+		++received;
+	}
+}
+
+void test_async_queue_threads()
+{
+	auto runner = ghostl::run_task(run_consumer());
+	runner.resume();
+	std::thread producer([]() {
+		for (unsigned c = 0; c < MESSAGES; ++c)
+		{
+			while (!async_queue.push(c)) std::this_thread::yield();
+		}
+		});
+	producer.join();
+	check(received + async_queue.dropped() == MESSAGES, "every item is popped or dropped");
+}
+
+int main()
+{
+	test_circular_queue_sojourn();
+	test_circular_queue_dropping();
+	test_circular_queue_rejecting();
+	test_async_queue_sojourn();
+	test_async_queue_dropping();
+	test_async_queue_threads();
+	return test_result("codel");
+}
@@ -0,0 +1,32 @@
+// example_check.h : The checks shared by the behavioural example tests.
+// Each test calls check() for its expectations, and returns test_result() from main().
+//
+
+#pragma once
+
+#include <iostream>
+#include <atomic>
+
+inline std::atomic<int>& test_failures()
+{
+	static std::atomic<int> failures{ 0 };
+	return failures;
+}
+
+// Report and count a failed expectation, and carry on, so that a run reports all of them.
+inline void check(const bool condition, const char* what)
+{
+	if (!condition)
+	{
+		std::cerr << "FAILED: " << what << std::endl;
+		++test_failures();
+	}
+}
+
+// Report the outcome of the named test, and get the exit code for main().
+inline int test_result(const char* name)
+{
+	const bool failed = test_failures() > 0;
+	std::cerr << name << (failed ? " test failed" : " test passed") << std::endl;
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,129 @@
+// latest_value_test.cpp : Tests the seqlock and triple_buffer latest-value mailboxes.
+//
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <seqlock.h>
+#include <triple_buffer.h>
+#include "../example_check.h"
+
+// A value that is torn if its fields disagree.
+struct sample
+{
+	unsigned seq;
+	unsigned data[15];
+	void fill(const unsigned s)
+	{
+		seq = s;
+		for (auto& d : data) d = s * 3;
+	}
+	bool whole() const
+	{
+		for (const auto& d : data) if (d != seq * 3) return false;
+		return true;
+	}
+};
+
+constexpr unsigned MESSAGES = 200000;
+const unsigned READER_THREAD_CNT = 2;
+
+void test_seqlock()
+{
+	seqlock<int> mailbox(7);
+	int val = 0;
+	check(mailbox.load() == 7 && !mailbox.version(), "initial value");
+	check(mailbox.try_load(val) && val == 7, "try_load without writer");
+	mailbox.store(8);
+	mailbox.store(9);
+	check(mailbox.load() == 9 && mailbox.version() == 2, "load the latest value");
+}
+
+void test_seqlock_threads()
+{
+	seqlock<sample> mailbox;
+	std::atomic<bool> done{ false };
+	std::vector<std::thread> readers;
+	for (unsigned i = 0; i < READER_THREAD_CNT; ++i)
+	{
+		readers.emplace_back([&mailbox, &done]() {
+			unsigned last = 0;
+			while (!done.load())
+			{
+				const sample s = mailbox.load();
+				check(s.whole(), "seqlock value is never torn");
+				check(s.seq >= last, "seqlock values do not go back");
+				last = s.seq;
+				std::this_thread::yield();
+			}
+			});
+	}
+	sample s;
+	for (unsigned c = 1; c <= MESSAGES; ++c)
+	{
+		s.fill(c);
+		mailbox.store(s);
+		if (!(c % 256)) std::this_thread::yield();
+	}
+	done.store(true);
+	for (auto& reader : readers) reader.join();
+	check(mailbox.load().seq == MESSAGES && mailbox.version() == MESSAGES, "last value");
+}
+
+void test_triple_buffer()
+{
+	triple_buffer<int> buffer;
+	check(!buffer.update(), "nothing published");
+	buffer.write(1);
+	check(buffer.update() && buffer.front() == 1, "take the published value");
+	check(!buffer.update() && buffer.read() == 1, "front keeps the value");
+	buffer.write(2);
+	buffer.back() = 3;
+	buffer.publish();
+	check(buffer.read() == 3, "only the latest value is passed on");
+	for (int i = 4; i < 10; ++i)
+	{
+		buffer.write(i);
+		check(buffer.read() == i, "alternating write and read");
+	}
+}
+
+void test_triple_buffer_threads()
+{
+	triple_buffer<sample> buffer;
+	std::atomic<bool> done{ false };
+	std::thread reader([&buffer, &done]() {
+		unsigned last = 0;
+		for (;;)
+		{
+			const bool finished = done.load();
+			if (buffer.update())
+			{
+				check(buffer.front().whole(), "triple buffer value is never torn");
+				check(buffer.front().seq > last, "triple buffer values are newer");
+				last = buffer.front().seq;
+			}
+			if (finished) break;
+			std::this_thread::yield();
+		}
+		check(last == MESSAGES, "reader ends with the last value");
+		});
+	for (unsigned c = 1; c <= MESSAGES; ++c)
+	{
+		buffer.back().fill(c);
+		buffer.publish();
+		if (!(c % 256)) std::this_thread::yield();
+	}
+	done.store(true);
+	reader.join();
+}
+
+int main()
+{
+	test_seqlock();
+	test_seqlock_threads();
+	test_triple_buffer();
+	test_triple_buffer_threads();
+	return test_result("latest value");
+}
@@ -72,7 +72,7 @@ struct scheduled_fn_t
 
 // anonymous namespace provides compilation-unit internal linkage
 namespace {
-    static circular_queue_mp<scheduled_fn_t> schedule_queue(FASTSCHEDULER_FN_MAX_COUNT);
+    static circular_queue_mp<scheduled_fn_t, void, FASTSCHEDULER_FN_MAX_COUNT> schedule_queue;
     static decltype(micros()) yieldIntvl_us;
     static std::atomic<decltype(micros())> deadline_us;
 };
@@ -175,5 +175,12 @@ void run_scheduled_functions()
     fence.store(false);
 }
 
+#if CIRCULAR_QUEUE_STATS
+circular_queue_stats get_scheduled_function_stats()
+{
+    return schedule_queue.stats();
+}
+#endif
+
 #endif // ESP8266
 
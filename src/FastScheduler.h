@@ -78,4 +78,15 @@ decltype(micros()) get_scheduled_recurrent_delay_us();
 
 void run_scheduled_functions();
 
+#if CIRCULAR_QUEUE_STATS
+#include <circular_queue.h>
+
+// get_scheduled_function_stats() returns a snapshot of the usage
+// statistics of the internal queue, for sizing FASTSCHEDULER_FN_MAX_COUNT.
+// Recurrent functions are requeued, they count once as pushed.
+// Requires CIRCULAR_QUEUE_STATS.
+
+circular_queue_stats get_scheduled_function_stats();
+#endif
+
 #endif //_FASTSCHEDULER_H
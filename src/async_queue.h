@@ -21,6 +21,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <task_completion_source.h>
 #include <task.h>
 #include <lfllist.h>
+#include <codel.h>
 
 namespace ghostl
 {
@@ -84,9 +85,78 @@ namespace ghostl
             lfllist_type::erase(node);
             co_return item;
         }
+        /// <returns>Whether no item is left to pop. For the consumer, a snapshot otherwise.</returns>
+        auto empty() -> bool
+        {
+            return !lfllist_type::back();
+        }
 
     private:
         ghostl::lfllist<task_completion_source<>> tcs_queue;
         std::atomic<typename decltype(tcs_queue)::node_type*> cur_tcs;
     };
+
+    /// <summary>
+    /// An async_queue that stamps each item on push, and reports its sojourn time on pop.
+    /// By default, it drops nothing. With the codel Policy, see async_queue_codel, it acts
+    /// against standing queues: under overload, the consumer drops stale items, or producers
+    /// reject new ones. For a single consumer.
+    /// </summary>
+    template<typename T, class Policy = no_drop>
+    struct async_queue_sojourn
+    {
+        explicit async_queue_sojourn(const Policy& _policy = Policy()) : policy(_policy) {}
+        async_queue_sojourn(const async_queue_sojourn&) = delete;
+        async_queue_sojourn(async_queue_sojourn&&) = delete;
+        auto operator =(const async_queue_sojourn&)->async_queue_sojourn & = delete;
+        auto operator =(async_queue_sojourn&&)->async_queue_sojourn & = delete;
+
+        [[nodiscard]] auto push(T&& val) -> bool
+        {
+            if (policy.rejecting()) return false;
+            return queue.push({ std::move(val), sojourn_now() });
+        }
+        inline auto push(const T& val) -> bool ALWAYS_INLINE_ATTR
+        {
+            T v(val);
+            return push(std::move(v));
+        }
+        auto flush() -> void
+        {
+            queue.flush();
+        }
+        auto pop() -> ghostl::task<T>
+        {
+            for (;;)
+            {
+                auto element = co_await queue.pop();
+                const auto now = sojourn_now();
+                last_sojourn = now - element.stamp;
+                if (!policy.should_drop(last_sojourn, now, queue.empty())) co_return std::move(element.item);
+                ++dropped_count;
+            }
+        }
+        /// <returns>The sojourn time in microseconds of the item that was popped last.</returns>
+        auto sojourn() const -> uint32_t
+        {
+            return last_sojourn;
+        }
+        /// <returns>The number of items the policy has dropped.</returns>
+        auto dropped() const -> size_t
+        {
+            return dropped_count;
+        }
+
+    private:
+        async_queue<sojourn_stamped<T>> queue;
+        Policy policy;
+        uint32_t last_sojourn = 0;
+        size_t dropped_count = 0;
+    };
+
+    /// <summary>
+    /// An async_queue_sojourn with CoDel active queue management.
+    /// </summary>
+    template<typename T>
+    using async_queue_codel = async_queue_sojourn<T, codel>;
 }
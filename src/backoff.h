@@ -0,0 +1,119 @@
+#pragma once
+/*
+backoff.h - Backoff policies for the retry loops of the lock-free containers.
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __backoff_h
+#define __backoff_h
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+#else
+#include <thread>
+#endif
+#if !defined(ARDUINO) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#define GHOSTL_CPU_RELAX() _mm_pause()
+#elif defined(__GNUC__) && (defined(__aarch64__) || (defined(__arm__) && defined(__ARM_ARCH) && __ARM_ARCH >= 7))
+#define GHOSTL_CPU_RELAX() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define GHOSTL_CPU_RELAX() do {} while (0)
+#endif
+
+// A backoff policy is default constructed at the start of each retry loop,
+// and called once after every failed attempt, for instance a lost compare-exchange.
+
+namespace ghostl
+{
+    /// <summary>
+    /// Hint to the CPU that the caller is spinning. On x86 this is PAUSE,
+    /// which stops the pipeline from flooding with speculative loads, and yields
+    /// the core to its SMT sibling; on ARM it is YIELD; elsewhere it does nothing.
+    /// </summary>
+    inline void cpu_relax()
+    {
+        GHOSTL_CPU_RELAX();
+    }
+
+    /// <summary>
+    /// Retry immediately.
+    /// </summary>
+    struct no_backoff
+    {
+        inline void operator()() {}
+    };
+
+    /// <summary>
+    /// Relax the CPU once before each retry.
+    /// </summary>
+    struct spin_backoff
+    {
+        inline void operator()() { cpu_relax(); }
+    };
+
+    /// <summary>
+    /// Relax the CPU before each retry, doubling the number of pauses
+    /// from MinSpins for every retry, up to MaxSpins.
+    /// </summary>
+    template<unsigned MinSpins = 1, unsigned MaxSpins = 64>
+    struct exponential_backoff
+    {
+        static_assert(MinSpins > 0 && MinSpins <= MaxSpins, "exponential_backoff requires 0 < MinSpins <= MaxSpins");
+        void operator()()
+        {
+            for (unsigned i = 0; i < spins; ++i) cpu_relax();
+            if (spins < MaxSpins) spins = spins * 2 < MaxSpins ? spins * 2 : MaxSpins;
+        }
+    private:
+        unsigned spins = MinSpins;
+    };
+
+    /// <summary>
+    /// Relax the CPU for the first Spins retries, then yield the thread before
+    /// each further retry, so that a preempted competitor gets to complete.
+    /// Yielding is sched_yield() on POSIX hosts, or the Arduino yield(), which must not
+    /// be called from an ISR: do not use this policy for containers that are used in ISRs.
+    /// </summary>
+    template<unsigned Spins = 64>
+    struct yielding_backoff
+    {
+        void operator()()
+        {
+            if (retries < Spins)
+            {
+                ++retries;
+                cpu_relax();
+                return;
+            }
+#if defined(ARDUINO)
+            yield();
+#else
+            std::this_thread::yield();
+#endif
+        }
+    private:
+        unsigned retries = 0;
+    };
+
+    /// <summary>
+    /// The backoff policy that the containers use unless given another one.
+    /// </summary>
+    using default_backoff = exponential_backoff<>;
+}
+
+#endif // __backoff_h
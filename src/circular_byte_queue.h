@@ -0,0 +1,280 @@
+#pragma once
+/*
+circular_byte_queue.h - Implementation of a lock-free circular queue of variable-length records.
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __circular_byte_queue_h
+#define __circular_byte_queue_h
+
+#include "circular_queue.h"
+
+#if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
+#include <cstdint>
+#include <cstring>
+#else
+#include <string.h>
+#endif
+
+/*!
+    @brief  Instance class for a single-producer, single-consumer circular queue / ring buffer (FIFO)
+            of variable-length byte records. Each record is stored contiguously behind a length
+            word, so memory use tracks the payload size. A record that does not fit before the
+            end of the ring buffer is preceded by a skip marker and starts over at its beginning.
+            Records and their payloads are aligned to the size of a size_t.
+            This implementation is lock-free between producer and consumer.
+*/
+class circular_byte_queue
+{
+public:
+    /*!
+        @brief  A contiguous view of a record payload.
+    */
+    struct span
+    {
+        uint8_t* data;
+        size_t size;
+    };
+
+    circular_byte_queue() : m_size(0)
+    {
+        m_inPos.store(0);
+        m_outPosCache = 0;
+        m_skip = 0;
+        m_outPos.store(0);
+        m_inPosCache = 0;
+    }
+    /*!
+        @brief  Create a queue of at least the given capacity in bytes, rounded up to a power of two.
+                This includes the length words and padding of the records.
+    */
+    explicit circular_byte_queue(const size_t capacity) : circular_byte_queue()
+    {
+        size_t size = 4 * HEADER_SIZE;
+        while (size < capacity) size <<= 1;
+        m_buffer.reset(new size_t[size / HEADER_SIZE]);
+        m_size = size;
+    }
+    circular_byte_queue(const circular_byte_queue&) = delete;
+    circular_byte_queue& operator=(const circular_byte_queue&) = delete;
+
+    /*!
+        @brief  Get the size of the ring buffer in bytes.
+    */
+    size_t capacity() const
+    {
+        return m_size;
+    }
+
+    /*!
+        @brief  Get the largest payload size that push() accepts. Records up to this size
+                always fit once the consumer has made room, wherever the ring buffer wraps.
+    */
+    size_t max_record_size() const
+    {
+        return m_size ? m_size / 2 - HEADER_SIZE : 0;
+    }
+
+    /*!
+        @brief  Discard all records in the queue.
+    */
+    void flush()
+    {
+        m_inPosCache = m_inPos.load(std::memory_order_acquire);
+        m_outPos.store(m_inPosCache, std::memory_order_release);
+    }
+
+    /*!
+        @brief  Get a snapshot of the number of bytes occupied by records.
+    */
+    size_t available() const
+    {
+        return m_inPos.load(std::memory_order_acquire) - m_outPos.load(std::memory_order_relaxed);
+    }
+
+    /*!
+        @brief  Test whether a snapshot of the queue holds no records.
+    */
+    bool empty() const
+    {
+        return !available();
+    }
+
+    /*!
+        @brief  Get direct access to the storage of the next record, with room for up to
+                size payload bytes, for filling it in place. The queue is not changed
+                until commit_write().
+        @return A pointer to the payload storage, or nullptr if the queue has no room.
+    */
+    uint8_t* reserve_write(const size_t size);
+
+    /*!
+        @brief  Push the record that was reserved by reserve_write() into the queue,
+                with a payload of size bytes. size must not exceed the reserved size.
+    */
+    void commit_write(const size_t size);
+
+    /*!
+        @brief  Push a copy of size bytes from data into the queue as one record.
+        @return true if the queue accepted the record, false if the queue
+                had no room for it.
+    */
+    bool push(const void* data, const size_t size)
+    {
+        const auto payload = reserve_write(size);
+        if (!payload) return false;
+        memcpy(payload, data, size);
+        commit_write(size);
+        return true;
+    }
+
+    /*!
+        @brief  Get direct access to the next record in the queue, for reading it in place.
+                The queue is not changed until commit_read().
+        @return The payload span of the record. Its data is nullptr if the queue is empty.
+    */
+    span reserve_read();
+
+    /*!
+        @brief  Remove the record that was accessed since reserve_read() from the queue.
+    */
+    void commit_read();
+
+    /*!
+        @brief  Pop the next record from the queue, copying up to size bytes of its payload
+                into buffer. If buffer is nullptr, the record is simply discarded.
+        @return The full payload size of the popped record, which may exceed size,
+                or ~0 if the queue was empty.
+    */
+    size_t pop(void* buffer, const size_t size)
+    {
+        const auto record = reserve_read();
+        if (!record.data) return ~static_cast<size_t>(0);
+        if (buffer) memcpy(buffer, record.data, min(size, record.size));
+        commit_read();
+        return record.size;
+    }
+
+protected:
+    static constexpr size_t HEADER_SIZE = sizeof(size_t);
+    static constexpr size_t SKIP = ~static_cast<size_t>(0);
+
+    /*!
+        @brief  Get the number of bytes a record with the given payload size occupies.
+    */
+    static constexpr size_t frame(const size_t size)
+    {
+        return HEADER_SIZE + (size + HEADER_SIZE - 1) / HEADER_SIZE * HEADER_SIZE;
+    }
+
+    /*!
+        @brief  Get the number of bytes to skip at queue index pos before a record
+                of frameSize bytes is contiguous.
+    */
+    inline size_t skip(const size_t pos, const size_t frameSize) const ALWAYS_INLINE_ATTR
+    {
+        const size_t tail = m_size - (pos & (m_size - 1));
+        return frameSize > tail ? tail : 0;
+    }
+
+    inline uint8_t* at(const size_t pos) const ALWAYS_INLINE_ATTR
+    {
+        return reinterpret_cast<uint8_t*>(m_buffer.get()) + (pos & (m_size - 1));
+    }
+
+    /*!
+        @brief  Write the skip marker, if any, and the length word of a record at queue index pos.
+        @return The queue index of the record's length word.
+    */
+    size_t write_frame(size_t pos, const size_t skipSize, const size_t size)
+    {
+        if (skipSize)
+        {
+            *reinterpret_cast<size_t*>(at(pos)) = SKIP;
+            pos += skipSize;
+        }
+        *reinterpret_cast<size_t*>(at(pos)) = size;
+        return pos;
+    }
+
+    size_t m_size;
+#if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
+    std::unique_ptr<size_t[]> m_buffer;
+#else
+    std::unique_ptr<size_t> m_buffer;
+#endif
+
+    // Written by the producer; read by the consumer.
+    alignas(GHOSTL_CACHELINE_SIZE) std::atomic<size_t> m_inPos;
+    size_t m_outPosCache;
+    size_t m_skip;
+    // Written by the consumer; read by the producer.
+    alignas(GHOSTL_CACHELINE_SIZE) std::atomic<size_t> m_outPos;
+    size_t m_inPosCache;
+};
+
+inline uint8_t* circular_byte_queue::reserve_write(const size_t size)
+{
+    if (size > max_record_size()) return nullptr;
+    const auto inPos = m_inPos.load(std::memory_order_relaxed);
+    const auto frameSize = frame(size);
+    m_skip = skip(inPos, frameSize);
+    if (m_size - (inPos - m_outPosCache) < m_skip + frameSize)
+    {
+        m_outPosCache = m_outPos.load(std::memory_order_acquire);
+        if (m_size - (inPos - m_outPosCache) < m_skip + frameSize) return nullptr;
+    }
+    return at(inPos + m_skip) + HEADER_SIZE;
+}
+
+inline void circular_byte_queue::commit_write(const size_t size)
+{
+    const auto inPos = m_inPos.load(std::memory_order_relaxed);
+    const auto pos = write_frame(inPos, m_skip, size);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_inPos.store(pos + frame(size), std::memory_order_release);
+}
+
+inline circular_byte_queue::span circular_byte_queue::reserve_read()
+{
+    auto outPos = m_outPos.load(std::memory_order_relaxed);
+    if (m_inPosCache == outPos)
+    {
+        m_inPosCache = m_inPos.load(std::memory_order_acquire);
+        if (m_inPosCache == outPos) return { nullptr, 0 };
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    auto size = *reinterpret_cast<const size_t*>(at(outPos));
+    if (SKIP == size)
+    {
+        // The record that follows a skip marker is always published with it.
+        outPos += m_size - (outPos & (m_size - 1));
+        m_outPos.store(outPos, std::memory_order_release);
+        size = *reinterpret_cast<const size_t*>(at(outPos));
+    }
+    return { at(outPos) + HEADER_SIZE, size };
+}
+
+inline void circular_byte_queue::commit_read()
+{
+    const auto outPos = m_outPos.load(std::memory_order_relaxed);
+    const auto size = *reinterpret_cast<const size_t*>(at(outPos));
+    std::atomic_thread_fence(std::memory_order_release);
+    m_outPos.store(outPos + frame(size), std::memory_order_release);
+}
+
+#endif // __circular_byte_queue_h
@@ -0,0 +1,107 @@
+#pragma once
+/*
+circular_byte_queue_mp.h - Implementation of a lock-free circular queue of variable-length records.
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __circular_byte_queue_mp_h
+#define __circular_byte_queue_mp_h
+
+#include "circular_byte_queue.h"
+#include "circular_queue_mp.h"
+
+/*!
+    @brief  Instance class for a multi-producer, single-consumer circular queue / ring buffer (FIFO)
+            of variable-length byte records, see circular_byte_queue. Producers claim the bytes
+            of their records with the protocol of circular_queue_mp, see circular_queue_mp_protocol.
+            This implementation is lock-free between producers and consumer for the available(),
+            reserve_read(), pop(), and push() type functions. Producers that lose a race for
+            the claim retry after the Backoff policy, see backoff.h.
+*/
+template< class Backoff = ghostl::default_backoff >
+class basic_circular_byte_queue_mp : protected circular_byte_queue
+{
+public:
+    basic_circular_byte_queue_mp() : circular_byte_queue()
+    {
+        m_inPos_mp.store(0);
+        m_concurrent_mp.store(0);
+    }
+    explicit basic_circular_byte_queue_mp(const size_t capacity) : circular_byte_queue(capacity)
+    {
+        m_inPos_mp.store(0);
+        m_concurrent_mp.store(0);
+    }
+
+    using circular_byte_queue::span;
+    using circular_byte_queue::capacity;
+    using circular_byte_queue::max_record_size;
+    using circular_byte_queue::flush;
+    using circular_byte_queue::available;
+    using circular_byte_queue::empty;
+    using circular_byte_queue::reserve_read;
+    using circular_byte_queue::commit_read;
+    using circular_byte_queue::pop;
+
+    uint8_t* reserve_write(const size_t size) = delete;
+    void commit_write(const size_t size) = delete;
+
+    /*!
+        @brief  Push a copy of size bytes from data into the queue as one record,
+                guarded for multiple concurrent producers.
+        @return true if the queue accepted the record, false if the queue
+                had no room for it.
+    */
+    bool push(const void* data, const size_t size);
+
+protected:
+    std::atomic<size_t> m_inPos_mp;
+    std::atomic<int> m_concurrent_mp;
+};
+
+template< class Backoff >
+bool IRAM_ATTR basic_circular_byte_queue_mp<Backoff>::push(const void* data, const size_t size)
+{
+    using protocol = detail::circular_queue_mp_protocol<Backoff>;
+    if (size > max_record_size()) return false;
+    const auto frameSize = frame(size);
+    size_t inPos_mp;
+    size_t skipSize = 0;
+    if (!protocol::claim(m_inPos_mp, m_concurrent_mp, inPos_mp,
+        [this, frameSize, &skipSize](const size_t pos, size_t& next) -> size_t
+        {
+            skipSize = skip(pos, frameSize);
+            if (m_size - (pos - m_outPos.load(std::memory_order_acquire)) < skipSize + frameSize) return 0;
+            next = pos + skipSize + frameSize;
+            return skipSize + frameSize;
+        }))
+    {
+        protocol::publish(m_inPos_mp, m_concurrent_mp, m_inPos);
+        return false;
+    }
+
+    const auto pos = write_frame(inPos_mp, skipSize, size);
+    memcpy(at(pos) + HEADER_SIZE, data, size);
+
+    std::atomic_thread_fence(std::memory_order_release);
+    protocol::publish(m_inPos_mp, m_concurrent_mp, m_inPos);
+    return true;
+}
+
+using circular_byte_queue_mp = basic_circular_byte_queue_mp<>;
+
+#endif // __circular_byte_queue_mp_h
@@ -28,10 +28,12 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
 #include <atomic>
 #include <memory>
+#include <new>
 #include <algorithm>
 #include "Delegate.h"
 using std::min;
 #else
+#include <new.h>
 #include "ghostl.h"
 #endif
 
@@ -42,49 +44,446 @@ using std::min;
 #if defined(__GNUC__)
 #undef ALWAYS_INLINE_ATTR
 #define ALWAYS_INLINE_ATTR __attribute__((always_inline))
+#undef NOINLINE_ATTR
+#define NOINLINE_ATTR __attribute__((noinline))
 #else
 #define ALWAYS_INLINE_ATTR
+#define NOINLINE_ATTR
 #endif
 
+// Alignment that keeps independently written members on separate cache lines.
+// MCUs without a data cache only use it to keep the atomics naturally aligned.
+#ifndef GHOSTL_CACHELINE_SIZE
+#if defined(ESP32)
+#define GHOSTL_CACHELINE_SIZE 32
+#elif defined(ARDUINO)
+#define GHOSTL_CACHELINE_SIZE 4
+#else
+#define GHOSTL_CACHELINE_SIZE 64
+#endif
+#endif
+
+// Define CIRCULAR_QUEUE_WAIT as 1 for the blocking pop_wait() and push_wait() functions.
+// Each publishing push or pop then pays for a fence and a check for parked waiters.
+#ifndef CIRCULAR_QUEUE_WAIT
+#define CIRCULAR_QUEUE_WAIT 0
+#endif
+
+// The number of times a blocking wait polls the queue before parking the thread.
+#ifndef CIRCULAR_QUEUE_WAIT_SPINS
+#define CIRCULAR_QUEUE_WAIT_SPINS 1024
+#endif
+
+// Define CIRCULAR_QUEUE_MONOTONIC_INDICES as 1 for free-running queue indices also in queues
+// whose ring buffer size is not a power of two. The indices are then mapped to slots by a modulo
+// on access, and never wrap in practice, which takes a 64-bit size_t.
+#ifndef CIRCULAR_QUEUE_MONOTONIC_INDICES
+#define CIRCULAR_QUEUE_MONOTONIC_INDICES 0
+#endif
+
+// Define CIRCULAR_QUEUE_STREAM_THRESHOLD as a number of bytes, above which push_n() and pop_n()
+// copy trivially copyable elements with non-temporal stores, that bypass the data cache.
+// Pays off for batches that will not be read again soon. 0 disables it.
+#ifndef CIRCULAR_QUEUE_STREAM_THRESHOLD
+#define CIRCULAR_QUEUE_STREAM_THRESHOLD 0
+#endif
+
+// Define CIRCULAR_QUEUE_STATS as 1 for usage statistics of each queue, see stats().
+// Each push and pop then pays for relaxed atomic increments of its counters.
+#ifndef CIRCULAR_QUEUE_STATS
+#define CIRCULAR_QUEUE_STATS 0
+#endif
+
+// The number of equally wide occupancy ranges that the statistics histogram counts pushes by.
+#ifndef CIRCULAR_QUEUE_STATS_BUCKETS
+#define CIRCULAR_QUEUE_STATS_BUCKETS 8
+#endif
+
+#if CIRCULAR_QUEUE_STATS && defined(ARDUINO) && !defined(ESP8266) && !defined(ESP32)
+#error "CIRCULAR_QUEUE_STATS requires the STL atomics"
+#endif
+
+#if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
+#include <cstring>
+#include <type_traits>
+#if defined(__AVX2__) && defined(__GNUC__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#endif
+
+#if CIRCULAR_QUEUE_WAIT
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#endif
+
+#if CIRCULAR_QUEUE_STATS
+/*!
+    @brief  A snapshot of the usage statistics of a circular_queue.
+*/
+struct circular_queue_stats
+{
+    // The number of elements pushed.
+    size_t pushes;
+    // The number of elements popped or otherwise removed from the queue.
+    size_t pops;
+    // The number of elements that could not be pushed, because the queue was full.
+    size_t rejected;
+    // The highest number of elements in the queue, as seen after a push.
+    size_t high_water;
+    // The number of pushes by the occupancy they left the queue at, bucket i counting
+    // occupancies from i * (capacity + 1) / CIRCULAR_QUEUE_STATS_BUCKETS on.
+    size_t histogram[CIRCULAR_QUEUE_STATS_BUCKETS];
+};
+#endif
+
+namespace detail
+{
+#if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
+    template< typename T >
+    using circular_queue_allocator = std::allocator<T>;
+#else
+    /*!
+        @brief  The default allocator of circular_queue ring buffers where the STL is unavailable.
+    */
+    template< typename T >
+    struct circular_queue_allocator
+    {
+        using value_type = T;
+        T* allocate(const size_t n) { return static_cast<T*>(::operator new(sizeof(T) * n)); }
+        void deallocate(T* const p, const size_t) { ::operator delete(p); }
+    };
+#endif
+
+    /*!
+        @brief  The ring buffer of a circular_queue with a capacity of N elements that is
+                fixed at compile time, embedded in the queue object.
+                If N is a power of two, the queue indices run freely and are masked
+                into the buffer, otherwise they wrap at the buffer size of N + 1.
+                The allocator is unused.
+    */
+    template< typename T, size_t N, class Allocator = circular_queue_allocator<T> >
+    struct circular_queue_buffer
+    {
+        static constexpr bool masked = !(N & (N - 1));
+        circular_queue_buffer() {}
+        explicit circular_queue_buffer(const Allocator&) {}
+        // The slots are uninitialized storage, only the queue knows which of them hold
+        // elements, and relocates these itself.
+        circular_queue_buffer(circular_queue_buffer&&) {}
+        circular_queue_buffer& operator=(circular_queue_buffer&&) { return *this; }
+        static constexpr size_t size() { return masked ? N : N + 1; }
+        T* get() { return reinterpret_cast<T*>(m_slots); }
+        const T* get() const { return reinterpret_cast<const T*>(m_slots); }
+        T& operator[](const size_t i) { return get()[i]; }
+        const T& operator[](const size_t i) const { return get()[i]; }
+    private:
+        // A masked queue has no spare slot in the ring, it keeps its pending pushpeek()
+        // element in the extra slot at index N.
+        alignas(T) unsigned char m_slots[sizeof(T) * (N + 1)];
+    };
+
+    /*!
+        @brief  The ring buffer of a circular_queue with a capacity that is set at runtime,
+                obtained from the allocator. The queue indices wrap at the buffer size.
+    */
+    template< typename T, class Allocator >
+    struct circular_queue_buffer<T, 0, Allocator>
+    {
+        static constexpr bool masked = false;
+        circular_queue_buffer() : m_size(1), m_slots(nullptr) {}
+        explicit circular_queue_buffer(const Allocator& alloc) : m_alloc(alloc), m_size(1), m_slots(nullptr) {}
+        circular_queue_buffer(const size_t size, const Allocator& alloc = Allocator()) :
+            m_alloc(alloc), m_size(size), m_slots(m_alloc.allocate(size)) {}
+        circular_queue_buffer(circular_queue_buffer&& other) :
+            m_alloc(std::move(other.m_alloc)), m_size(other.m_size), m_slots(other.m_slots)
+        {
+            other.m_size = 1;
+            other.m_slots = nullptr;
+        }
+        circular_queue_buffer& operator=(circular_queue_buffer&& other)
+        {
+            if (&other != this)
+            {
+                deallocate();
+                m_alloc = std::move(other.m_alloc);
+                m_size = other.m_size;
+                m_slots = other.m_slots;
+                other.m_size = 1;
+                other.m_slots = nullptr;
+            }
+            return *this;
+        }
+        ~circular_queue_buffer()
+        {
+            deallocate();
+        }
+        const Allocator& allocator() const { return m_alloc; }
+        size_t size() const { return m_size; }
+        T* get() { return m_slots; }
+        const T* get() const { return m_slots; }
+        T& operator[](const size_t i) { return m_slots[i]; }
+        const T& operator[](const size_t i) const { return m_slots[i]; }
+    private:
+        void deallocate()
+        {
+            if (m_slots) m_alloc.deallocate(m_slots, m_size);
+        }
+
+        Allocator m_alloc;
+        size_t m_size;
+        T* m_slots;
+    };
+
+#if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
+#if CIRCULAR_QUEUE_STREAM_THRESHOLD && defined(__SSE2__)
+    /*!
+        @brief  Copy a block of at least 16 bytes with non-temporal stores.
+                It is not inlined, so that the compiler does not check its head and tail
+                copies against small buffers of callers that never take this path.
+    */
+    inline void NOINLINE_ATTR stream_copy(void* to, const void* from, size_t bytes)
+    {
+        auto dst = static_cast<char*>(to);
+        auto src = static_cast<const char*>(from);
+        const size_t head = (16 - reinterpret_cast<uintptr_t>(dst) % 16) % 16;
+        memcpy(dst, src, head);
+        dst += head;
+        src += head;
+        bytes -= head;
+        for (; bytes >= 16; bytes -= 16, dst += 16, src += 16)
+        {
+            _mm_stream_si128(reinterpret_cast<__m128i*>(dst), _mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+        }
+        memcpy(dst, src, bytes);
+        // Non-temporal stores are weakly ordered, they must complete before the queue index is published.
+        _mm_sfence();
+    }
+#endif
+
+    /*!
+        @brief  Copy a block of bytes, with non-temporal stores above CIRCULAR_QUEUE_STREAM_THRESHOLD.
+    */
+    inline void bulk_copy(void* to, const void* from, const size_t bytes)
+    {
+#if CIRCULAR_QUEUE_STREAM_THRESHOLD && defined(__SSE2__)
+        if (bytes >= CIRCULAR_QUEUE_STREAM_THRESHOLD && bytes >= 16)
+        {
+            stream_copy(to, from, bytes);
+            return;
+        }
+#endif
+        memcpy(to, from, bytes);
+    }
+
+    /*!
+        @brief  Copy-construct n elements into uninitialized storage. Trivially copyable elements
+                are copied in one block.
+    */
+    template< typename T >
+    inline void uninitialized_copy_n(const T* from, const size_t n, T* to, std::true_type)
+    {
+        if (n) bulk_copy(to, from, n * sizeof(T));
+    }
+    template< typename T >
+    inline void uninitialized_copy_n(const T* from, const size_t n, T* to, std::false_type)
+    {
+        std::uninitialized_copy_n(from, n, to);
+    }
+    template< typename T >
+    inline void uninitialized_copy_n(const T* from, const size_t n, T* to)
+    {
+        uninitialized_copy_n(from, n, to, std::integral_constant<bool, std::is_trivially_copyable<T>::value>());
+    }
+
+    /*!
+        @brief  Move-assign n elements. Trivially copyable elements are copied in one block.
+    */
+    template< typename T >
+    inline void move_n(T* from, const size_t n, T* to, std::true_type)
+    {
+        if (n) bulk_copy(to, from, n * sizeof(T));
+    }
+    template< typename T >
+    inline void move_n(T* from, const size_t n, T* to, std::false_type)
+    {
+        std::copy_n(std::make_move_iterator(from), n, to);
+    }
+    template< typename T >
+    inline void move_n(T* from, const size_t n, T* to)
+    {
+        move_n(from, n, to, std::integral_constant<bool, std::is_trivially_copyable<T>::value>());
+    }
+#endif
+
+    /*!
+        @brief  Find the first of size elements at data that equals any of count values.
+        @return The index of the element, or size if there is none.
+    */
+    template< typename T >
+    inline size_t find_any(const T* data, const size_t size, const T* values, const size_t count)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            for (size_t j = 0; j < count; ++j)
+            {
+                if (data[i] == values[j]) return i;
+            }
+        }
+        return size;
+    }
+
+    /*!
+        @brief  Find the first of size bytes at data that equals any of count values.
+                Up to 8 values are compared with 32 or 16 bytes at a time, using
+                AVX2, SSE2, or NEON instructions, where available.
+        @return The index of the byte, or size if there is none.
+    */
+    inline size_t find_any(const uint8_t* data, const size_t size, const uint8_t* values, const size_t count)
+    {
+        size_t i = 0;
+        if (!count) return size;
+#if defined(__AVX2__) && defined(__GNUC__)
+        if (count <= 8)
+        {
+            __m256i needles[8];
+            for (size_t j = 0; j < count; ++j) needles[j] = _mm256_set1_epi8(static_cast<char>(values[j]));
+            for (; i + 32 <= size; i += 32)
+            {
+                const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+                __m256i hits = _mm256_cmpeq_epi8(chunk, needles[0]);
+                for (size_t j = 1; j < count; ++j) hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, needles[j]));
+                const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hits));
+                if (mask) return i + __builtin_ctz(mask);
+            }
+        }
+#elif defined(__SSE2__)
+        if (count <= 8)
+        {
+            __m128i needles[8];
+            for (size_t j = 0; j < count; ++j) needles[j] = _mm_set1_epi8(static_cast<char>(values[j]));
+            for (; i + 16 <= size; i += 16)
+            {
+                const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                __m128i hits = _mm_cmpeq_epi8(chunk, needles[0]);
+                for (size_t j = 1; j < count; ++j) hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, needles[j]));
+                const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hits));
+                if (mask) return i + __builtin_ctz(mask);
+            }
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        if (count <= 8)
+        {
+            uint8x16_t needles[8];
+            for (size_t j = 0; j < count; ++j) needles[j] = vdupq_n_u8(values[j]);
+            for (; i + 16 <= size; i += 16)
+            {
+                const uint8x16_t chunk = vld1q_u8(data + i);
+                uint8x16_t hits = vceqq_u8(chunk, needles[0]);
+                for (size_t j = 1; j < count; ++j) hits = vorrq_u8(hits, vceqq_u8(chunk, needles[j]));
+                // The scalar scan below locates the hit within the chunk.
+                if (vmaxvq_u8(hits)) break;
+            }
+        }
+#endif
+        return i + find_any<uint8_t>(data + i, size - i, values, count);
+    }
+
+    inline size_t find_any(const char* data, const size_t size, const char* values, const size_t count)
+    {
+        return find_any(reinterpret_cast<const uint8_t*>(data), size, reinterpret_cast<const uint8_t*>(values), count);
+    }
+}
+
 /*!
     @brief  Instance class for a single-producer, single-consumer circular queue / ring buffer (FIFO).
             This implementation is lock-free between producer and consumer for the available(), peek(),
             pop(), and push() type functions.
+            If N is non-zero, the capacity is fixed to N at compile time and the ring buffer is
+            embedded in the queue object instead of being allocated from the heap.
+            Otherwise, the ring buffer is obtained from Allocator, see mmap_allocator.h.
+            The ring buffer is uninitialized storage: elements are constructed in place when
+            pushed and destroyed when popped, so T need not be default-constructible.
 */
-template< typename T, typename ForEachArg = void >
+template< typename T, typename ForEachArg = void, size_t N = 0, class Allocator = detail::circular_queue_allocator<T> >
 class circular_queue
 {
 public:
     /*!
-        @brief  Constructs a valid, but zero-capacity dummy queue.
+        @brief  A contiguous range of elements in the ring buffer.
+    */
+    struct span
+    {
+        T* data;
+        size_t size;
+    };
+
+    /*!
+        @brief  Up to two contiguous ranges of elements in the ring buffer, in queue order.
+                The second range is only non-empty if the first one ends at the end of the
+                ring buffer.
+    */
+    struct spans
+    {
+        span first;
+        span second;
+        size_t size() const { return first.size + second.size; }
+    };
+
+    /*!
+        @brief  Constructs a valid, but zero-capacity dummy queue, or
+                a queue of the fixed capacity N.
     */
-    circular_queue() : m_bufSize(1)
+    circular_queue()
     {
         m_inPos.store(0);
+        m_outPosCache = 0;
+        m_pushpeeked = false;
         m_outPos.store(0);
+        m_inPosCache = 0;
     }
     /*!
         @brief  Constructs a queue of the given maximum capacity.
     */
-    circular_queue(const size_t capacity) : m_bufSize(capacity + 1), m_buffer(new T[m_bufSize])
+    circular_queue(const size_t capacity, const Allocator& alloc = Allocator()) : m_buffer(capacity + 1, alloc)
     {
         m_inPos.store(0);
+        m_outPosCache = 0;
+        m_pushpeeked = false;
         m_outPos.store(0);
+        m_inPosCache = 0;
     }
     circular_queue(circular_queue&& cq) :
-        m_bufSize(cq.m_bufSize), m_buffer(cq.m_buffer), m_inPos(cq.m_inPos.load()), m_outPos(cq.m_outPos.load())
-    {}
+        m_buffer(std::move(cq.m_buffer)),
+        m_inPos(cq.m_inPos.load()), m_outPosCache(cq.m_outPosCache),
+        m_outPos(cq.m_outPos.load()), m_inPosCache(cq.m_inPosCache)
+    {
+        take(cq);
+    }
     ~circular_queue()
     {
-        m_buffer.reset();
+        discard_pending();
+        flush();
     }
     circular_queue(const circular_queue&) = delete;
     circular_queue& operator=(circular_queue&& cq)
     {
-        m_bufSize = cq.m_bufSize;
-        m_buffer = cq.m_buffer;
-        m_inPos.store(cq.m_inPos.load());
-        m_outPos.store(cq.m_outPos.load());
+        if (&cq != this)
+        {
+            discard_pending();
+            flush();
+            m_buffer = std::move(cq.m_buffer);
+            m_inPos.store(cq.m_inPos.load());
+            m_outPosCache = cq.m_outPosCache;
+            m_outPos.store(cq.m_outPos.load());
+            m_inPosCache = cq.m_inPosCache;
+            take(cq);
+        }
+        return *this;
     }
     circular_queue& operator=(const circular_queue&) = delete;
 
@@ -93,7 +492,7 @@ public:
     */
     size_t capacity() const
     {
-        return m_bufSize - 1;
+        return buffer_type::masked ? N : m_buffer.size() - 1;
     }
 
     /*!
@@ -102,6 +501,7 @@ public:
                 will lead to corruption.
         @return True if the new capacity could accommodate the present elements in
                 the queue, otherwise nothing is done and false is returned.
+                A queue of fixed capacity N cannot be resized.
     */
     bool capacity(const size_t cap);
 
@@ -110,7 +510,7 @@ public:
     */
     void flush()
     {
-        m_outPos.store(m_inPos.load());
+        consume(~static_cast<size_t>(0), [](T&) {});
     }
 
     /*!
@@ -118,9 +518,8 @@ public:
     */
     size_t IRAM_ATTR available() const
     {
-        int avail = static_cast<int>(m_inPos.load() - m_outPos.load());
-        if (avail < 0) avail += static_cast<int>(m_bufSize);
-        return avail;
+        const auto inPos = m_inPos.load();
+        return distance(m_outPos.load(), inPos);
     }
 
     /*!
@@ -128,48 +527,111 @@ public:
     */
     size_t IRAM_ATTR available_for_push() const
     {
-        int avail = static_cast<int>(m_outPos.load() - m_inPos.load()) - 1;
-        if (avail < 0) avail += static_cast<int>(m_bufSize);
-        return avail;
+        const auto inPos = m_inPos.load();
+        return capacity() - distance(m_outPos.load(), inPos);
+    }
+
+    /*!
+        @brief  Get a snapshot of the number of elements pushed into the queue so far.
+                Requires free-running indices, that is, a fixed power-of-two capacity or
+                CIRCULAR_QUEUE_MONOTONIC_INDICES. Changing the capacity restarts the count.
+    */
+    size_t push_sequence() const
+    {
+        static_assert(monotonic, "push_sequence() requires free-running queue indices");
+        return m_inPos.load(std::memory_order_acquire);
+    }
+
+    /*!
+        @brief  Get a snapshot of the number of elements popped from the queue so far.
+                Requires free-running indices, see push_sequence().
+    */
+    size_t pop_sequence() const
+    {
+        static_assert(monotonic, "pop_sequence() requires free-running queue indices");
+        return m_outPos.load(std::memory_order_acquire);
+    }
+
+#if CIRCULAR_QUEUE_STATS
+    /*!
+        @brief  Get a snapshot of the usage statistics of the queue. The counters are read
+                one by one, while producer and consumer carry on, so they may not be
+                exactly consistent with each other.
+    */
+    circular_queue_stats stats() const
+    {
+        circular_queue_stats snapshot;
+        snapshot.pushes = m_statPushes.load(std::memory_order_relaxed);
+        snapshot.pops = m_statPops.load(std::memory_order_relaxed);
+        snapshot.rejected = m_statRejected.load(std::memory_order_relaxed);
+        snapshot.high_water = m_statHighWater.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < CIRCULAR_QUEUE_STATS_BUCKETS; ++i)
+        {
+            snapshot.histogram[i] = m_statHistogram[i].load(std::memory_order_relaxed);
+        }
+        return snapshot;
     }
+#endif
 
     /*!
         @brief  Peek at the next element pop will return without removing it from the queue.
         @return An rvalue copy of the next element that can be popped. If the queue is empty,
-                return an rvalue copy of the element that is pending the next push.
+                return a default value of type T.
     */
     T peek() const
     {
         const auto outPos = m_outPos.load(std::memory_order_relaxed);
-        std::atomic_thread_fence(std::memory_order_acquire);
-        return m_buffer[outPos];
+        if (m_inPos.load(std::memory_order_acquire) == outPos) return {};
+        return m_buffer[slot(outPos)];
     }
 
     /*!
-        @brief  Peek at the next pending input value.
+        @brief  Peek at the next pending input value. It is default-constructed
+                on the first call after the previous push.
         @return A reference to the next element that can be pushed.
     */
     T& IRAM_ATTR pushpeek()
     {
-        const auto inPos = m_inPos.load(std::memory_order_relaxed);
-        std::atomic_thread_fence(std::memory_order_acquire);
-        return m_buffer[inPos];
+        if (!m_pushpeeked)
+        {
+            new (pending()) T();
+            m_pushpeeked = true;
+        }
+        return *pending();
     }
 
     /*!
         @brief  Release the next pending input value, accessible by pushpeek(), into the queue.
+                Without a prior pushpeek(), a default value of type T is pushed.
         @return true if the queue accepted the value, false if the queue
                 was full.
     */
     bool IRAM_ATTR push()
     {
-        const auto inPos = m_inPos.load(std::memory_order_acquire);
-        const size_t next = (inPos + 1) % m_bufSize;
-        if (next == m_outPos.load(std::memory_order_relaxed)) {
-            return false;
+        const auto inPos = m_inPos.load(std::memory_order_relaxed);
+        if (distance(m_outPosCache, inPos) == capacity()) {
+            m_outPosCache = m_outPos.load(std::memory_order_acquire);
+            if (distance(m_outPosCache, inPos) == capacity())
+            {
+                record_reject(1);
+                return false;
+            }
+        }
+        if (buffer_type::masked)
+        {
+            T* const element = m_buffer.get() + slot(inPos);
+            if (m_pushpeeked) relocate(element, pending());
+            else new (element) T();
+        }
+        else if (!m_pushpeeked)
+        {
+            new (m_buffer.get() + slot(inPos)) T();
         }
+        m_pushpeeked = false;
         std::atomic_thread_fence(std::memory_order_release);
-        m_inPos.store(next, std::memory_order_release);
+        m_inPos.store(advance(inPos, 1), std::memory_order_release);
+        record_push(1, advance(inPos, 1));
+        notify_waiting();
         return true;
     }
 
@@ -180,14 +642,21 @@ public:
     */
     bool IRAM_ATTR push(T&& val)
     {
-        const auto inPos = m_inPos.load(std::memory_order_acquire);
-        const size_t next = (inPos + 1) % m_bufSize;
-        if (next == m_outPos.load(std::memory_order_relaxed)) {
-            return false;
+        const auto inPos = m_inPos.load(std::memory_order_relaxed);
+        if (distance(m_outPosCache, inPos) == capacity()) {
+            m_outPosCache = m_outPos.load(std::memory_order_acquire);
+            if (distance(m_outPosCache, inPos) == capacity())
+            {
+                record_reject(1);
+                return false;
+            }
         }
-        m_buffer[inPos] = std::move(val);
+        discard_pending();
+        new (m_buffer.get() + slot(inPos)) T(std::move(val));
         std::atomic_thread_fence(std::memory_order_release);
-        m_inPos.store(next, std::memory_order_release);
+        m_inPos.store(advance(inPos, 1), std::memory_order_release);
+        record_push(1, advance(inPos, 1));
+        notify_waiting();
         return true;
     }
 
@@ -202,6 +671,61 @@ public:
         return push(std::move(v));
     }
 
+#if CIRCULAR_QUEUE_WAIT
+    /*!
+        @brief  Move the rvalue parameter into the queue, blocking while the queue is full.
+    */
+    void push_wait(T&& val)
+    {
+        while (!push(std::move(val)))
+        {
+            park([this]() { return available_for_push() > 0; }, [this](std::unique_lock<std::mutex>& lock)
+                {
+                    m_waitCv.wait(lock);
+                    return true;
+                });
+        }
+    }
+
+    /*!
+        @brief  Push a copy of the parameter into the queue, blocking while the queue is full.
+    */
+    inline void push_wait(const T& val) ALWAYS_INLINE_ATTR
+    {
+        T v(val);
+        push_wait(std::move(v));
+    }
+
+    /*!
+        @brief  Move the rvalue parameter into the queue, blocking while the queue is full,
+                until the deadline passes.
+        @return true if the queue accepted the value, false if the deadline passed first.
+    */
+    template< typename Clock, typename Duration >
+    bool push_wait_until(T&& val, const std::chrono::time_point<Clock, Duration>& deadline)
+    {
+        while (!push(std::move(val)))
+        {
+            if (!park([this]() { return available_for_push() > 0; }, [this, &deadline](std::unique_lock<std::mutex>& lock)
+                {
+                    return m_waitCv.wait_until(lock, deadline) == std::cv_status::no_timeout;
+                })) return false;
+        }
+        return true;
+    }
+
+    /*!
+        @brief  Move the rvalue parameter into the queue, blocking while the queue is full,
+                for at most the given timeout.
+        @return true if the queue accepted the value, false if the timeout expired first.
+    */
+    template< typename Rep, typename Period >
+    inline bool push_wait_for(T&& val, const std::chrono::duration<Rep, Period>& timeout)
+    {
+        return push_wait_until(std::move(val), std::chrono::steady_clock::now() + timeout);
+    }
+#endif
+
 #if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
     /*!
         @brief  Push copies of multiple elements from a buffer into the queue,
@@ -212,6 +736,30 @@ public:
     size_t push_n(const T* buffer, size_t size);
 #endif
 
+    /*!
+        @brief  Get direct access to up to n free elements in the ring buffer, that are
+                next in line for pushing, for filling them in place. The queue is not
+                changed until commit_write().
+                The spans are uninitialized storage, elements must be constructed in place,
+                for instance by placement new. Trivially copyable elements may simply be written.
+        @return The spans of elements that can be written to, which may be fewer than n.
+    */
+    spans reserve_write(size_t n);
+
+    /*!
+        @brief  Release the first k elements, that were filled in place since
+                reserve_write(), into the queue. k must not exceed the size of
+                the spans returned by reserve_write().
+    */
+    void IRAM_ATTR commit_write(const size_t k)
+    {
+        const auto inPos = m_inPos.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_inPos.store(advance(inPos, k), std::memory_order_release);
+        record_push(k, advance(inPos, k));
+        notify_waiting();
+    }
+
     /*!
         @brief  Pop the next available element from the queue.
         @return An rvalue copy of the popped element, or a default
@@ -219,6 +767,64 @@ public:
     */
     T pop();
 
+#if CIRCULAR_QUEUE_WAIT
+    /*!
+        @brief  Pop the next available element from the queue, blocking while the queue is empty.
+        @return An rvalue copy of the popped element.
+    */
+    T pop_wait()
+    {
+        while (!available())
+        {
+            park([this]() { return available() > 0; }, [this](std::unique_lock<std::mutex>& lock)
+                {
+                    m_waitCv.wait(lock);
+                    return true;
+                });
+        }
+        return pop();
+    }
+
+    /*!
+        @brief  Pop the next available element from the queue, blocking while the queue is empty,
+                until the deadline passes.
+        @return true if val received the popped element, false if the deadline passed first.
+    */
+    template< typename Clock, typename Duration >
+    bool pop_wait_until(T& val, const std::chrono::time_point<Clock, Duration>& deadline)
+    {
+        while (!available())
+        {
+            if (!park([this]() { return available() > 0; }, [this, &deadline](std::unique_lock<std::mutex>& lock)
+                {
+                    return m_waitCv.wait_until(lock, deadline) == std::cv_status::no_timeout;
+                })) return false;
+        }
+        val = pop();
+        return true;
+    }
+
+    /*!
+        @brief  Pop the next available element from the queue, blocking while the queue is empty,
+                for at most the given timeout.
+        @return true if val received the popped element, false if the timeout expired first.
+    */
+    template< typename Rep, typename Period >
+    inline bool pop_wait_for(T& val, const std::chrono::duration<Rep, Period>& timeout)
+    {
+        return pop_wait_until(val, std::chrono::steady_clock::now() + timeout);
+    }
+
+    /*!
+        @brief  Set the number of times the blocking wait functions poll the queue
+                before parking the thread.
+    */
+    void wait_spins(const size_t spins)
+    {
+        m_waitSpins = spins;
+    }
+#endif
+
 #if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
     /*!
         @brief  Pop multiple elements in ordered sequence from the queue to a buffer.
@@ -229,6 +835,78 @@ public:
     size_t pop_n(T* buffer, size_t size);
 #endif
 
+    /*!
+        @brief  Find the first available element that equals value, scanning across
+                the end of the ring buffer. Byte queues are scanned with SIMD instructions,
+                where available. Can only safely be called from the consumer.
+        @return The number of available elements that precede it, such that pop_n() of
+                one more extracts everything up to and including the element, or npos
+                if none of the available elements equals value.
+    */
+    inline size_t find(const T& value) ALWAYS_INLINE_ATTR
+    {
+        return find_any(&value, 1);
+    }
+
+    /*!
+        @brief  Find the first available element that equals any of count values,
+                for instance one of a set of frame delimiters, see find().
+        @return The number of available elements that precede it, or npos
+                if none of the available elements equals any of the values.
+    */
+    size_t find_any(const T* values, size_t count);
+
+    /*!
+        @brief  The result of find() and find_any() if no element matches.
+    */
+    static constexpr size_t npos = ~static_cast<size_t>(0);
+
+    /*!
+        @brief  Get direct access to up to n available elements in the ring buffer,
+                in queue order, for reading or parsing them in place. The elements
+                remain in the queue until commit_read().
+        @return The spans of available elements, which may be fewer than n.
+    */
+    spans reserve_read(size_t n);
+
+    /*!
+        @brief  Remove and destroy the first k available elements, that were accessed since
+                reserve_read(), from the queue. k must not exceed the size of
+                the spans returned by reserve_read().
+    */
+    void IRAM_ATTR commit_read(const size_t k)
+    {
+        const auto outPos = m_outPos.load(std::memory_order_relaxed);
+        destroy(split(outPos, k));
+        std::atomic_thread_fence(std::memory_order_release);
+        m_outPos.store(advance(outPos, k), std::memory_order_release);
+        record_pop(k);
+        notify_waiting();
+    }
+
+    /*!
+        @brief  Remove up to max available elements from the queue in one batch,
+                calling back visitor with a reference to every single element
+                in place. The consumer index is published once, after the last
+                element was visited.
+        @return The number of elements that were consumed.
+    */
+    template< typename Visitor >
+    size_t consume(const size_t max, Visitor visitor)
+    {
+        const auto elements = reserve_read(max);
+        for (auto element = elements.first.data; element != elements.first.data + elements.first.size; ++element)
+        {
+            visitor(*element);
+        }
+        for (auto element = elements.second.data; element != elements.second.data + elements.second.size; ++element)
+        {
+            visitor(*element);
+        }
+        if (elements.size()) commit_read(elements.size());
+        return elements.size();
+    }
+
     /*!
         @brief  Iterate over and remove each available element from queue,
                 calling back fun with an rvalue reference of every single element.
@@ -252,133 +930,441 @@ public:
 #endif
 
 protected:
-    size_t m_bufSize;
-#if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
-    std::unique_ptr<T[]> m_buffer;
+    using buffer_type = detail::circular_queue_buffer<T, N, Allocator>;
+
+    // Whether the queue indices are free-running counters instead of wrapping at the ring buffer size.
+    static constexpr bool monotonic = buffer_type::masked || CIRCULAR_QUEUE_MONOTONIC_INDICES;
+#if CIRCULAR_QUEUE_MONOTONIC_INDICES
+    static_assert(sizeof(size_t) >= 8, "CIRCULAR_QUEUE_MONOTONIC_INDICES requires a 64-bit size_t");
+#endif
+
+    /*!
+        @brief  Map a queue index to its slot in the ring buffer.
+    */
+    inline size_t slot(const size_t pos) const ALWAYS_INLINE_ATTR
+    {
+        if (buffer_type::masked) return pos & (N - 1);
+        return monotonic ? pos % m_buffer.size() : pos;
+    }
+
+    /*!
+        @brief  Get the queue index that is n elements after pos,
+                for n not exceeding the ring buffer size.
+    */
+    inline size_t advance(const size_t pos, const size_t n) const ALWAYS_INLINE_ATTR
+    {
+        if (monotonic) return pos + n;
+        const size_t next = pos + n;
+        return next >= m_buffer.size() ? next - m_buffer.size() : next;
+    }
+
+    /*!
+        @brief  Get the queue index that immediately precedes pos.
+    */
+    inline size_t retreat(const size_t pos) const ALWAYS_INLINE_ATTR
+    {
+        if (monotonic) return pos - 1;
+        return (pos ? pos : m_buffer.size()) - 1;
+    }
+
+    /*!
+        @brief  Get the number of elements from queue index from up to, but excluding, to.
+    */
+    inline size_t distance(const size_t from, const size_t to) const ALWAYS_INLINE_ATTR
+    {
+        if (monotonic) return to - from;
+        return to >= from ? to - from : to + m_buffer.size() - from;
+    }
+
+    /*!
+        @brief  Get the spans of n elements in the ring buffer, starting at queue index pos.
+    */
+    spans split(const size_t pos, const size_t n)
+    {
+        const auto first = slot(pos);
+        const size_t firstSize = min(n, static_cast<size_t>(m_buffer.size() - first));
+        return { { m_buffer.get() + first, firstSize }, { m_buffer.get(), n - firstSize } };
+    }
+
+    /*!
+        @brief  Get the storage of the pending pushpeek() element.
+    */
+    T* pending()
+    {
+        return m_buffer.get() + (buffer_type::masked ? N : slot(m_inPos.load(std::memory_order_relaxed)));
+    }
+
+    /*!
+        @brief  Destroy the pending pushpeek() element, if there is one.
+    */
+    void discard_pending()
+    {
+        if (!m_pushpeeked) return;
+        pending()->~T();
+        m_pushpeeked = false;
+    }
+
+    /*!
+        @brief  Move-construct an element into the storage at to, and destroy it at from.
+    */
+    static void relocate(T* const to, T* const from)
+    {
+        new (to) T(std::move(*from));
+        from->~T();
+    }
+
+    /*!
+        @brief  Destroy the elements in the spans.
+    */
+    static void destroy(const spans& elements)
+    {
+        for (auto element = elements.first.data; element != elements.first.data + elements.first.size; ++element)
+        {
+            element->~T();
+        }
+        for (auto element = elements.second.data; element != elements.second.data + elements.second.size; ++element)
+        {
+            element->~T();
+        }
+    }
+
+    /*!
+        @brief  Complete moving cq into this queue, after its buffer and indices were taken over.
+                The elements of an embedded buffer are relocated one by one.
+                Leaves cq empty.
+    */
+    void take(circular_queue& cq)
+    {
+        m_pushpeeked = cq.m_pushpeeked;
+        if (N)
+        {
+            const auto inPos = m_inPos.load();
+            for (auto pos = m_outPos.load(); pos != inPos; pos = advance(pos, 1))
+            {
+                relocate(m_buffer.get() + slot(pos), cq.m_buffer.get() + slot(pos));
+            }
+            if (m_pushpeeked) relocate(pending(), cq.pending());
+        }
+        cq.m_pushpeeked = false;
+#if CIRCULAR_QUEUE_STATS
+        m_statPushes.store(cq.m_statPushes.exchange(0));
+        m_statRejected.store(cq.m_statRejected.exchange(0));
+        m_statHighWater.store(cq.m_statHighWater.exchange(0));
+        for (size_t i = 0; i < CIRCULAR_QUEUE_STATS_BUCKETS; ++i)
+        {
+            m_statHistogram[i].store(cq.m_statHistogram[i].exchange(0));
+        }
+        m_statPops.store(cq.m_statPops.exchange(0));
+#endif
+        cq.m_inPos.store(0);
+        cq.m_outPosCache = 0;
+        cq.m_outPos.store(0);
+        cq.m_inPosCache = 0;
+    }
+
+    /*!
+        @brief  Count n pushed elements, which left the producer index at inPos.
+    */
+    inline void record_push(const size_t n, const size_t inPos) ALWAYS_INLINE_ATTR
+    {
+#if CIRCULAR_QUEUE_STATS
+        m_statPushes.fetch_add(n, std::memory_order_relaxed);
+        const size_t occupancy = distance(m_outPos.load(std::memory_order_relaxed), inPos);
+        auto highWater = m_statHighWater.load(std::memory_order_relaxed);
+        while (occupancy > highWater &&
+            !m_statHighWater.compare_exchange_weak(highWater, occupancy, std::memory_order_relaxed)) {}
+        const size_t bucket = min(occupancy * CIRCULAR_QUEUE_STATS_BUCKETS / (capacity() + 1),
+            static_cast<size_t>(CIRCULAR_QUEUE_STATS_BUCKETS - 1));
+        m_statHistogram[bucket].fetch_add(1, std::memory_order_relaxed);
+#else
+        (void)n;
+        (void)inPos;
+#endif
+    }
+
+    /*!
+        @brief  Count n elements that were rejected by a full queue.
+    */
+    inline void record_reject(const size_t n) ALWAYS_INLINE_ATTR
+    {
+#if CIRCULAR_QUEUE_STATS
+        m_statRejected.fetch_add(n, std::memory_order_relaxed);
+#else
+        (void)n;
+#endif
+    }
+
+    /*!
+        @brief  Count n popped elements.
+    */
+    inline void record_pop(const size_t n) ALWAYS_INLINE_ATTR
+    {
+#if CIRCULAR_QUEUE_STATS
+        m_statPops.fetch_add(n, std::memory_order_relaxed);
 #else
-    std::unique_ptr<T> m_buffer;
+        (void)n;
+#endif
+    }
+
+    /*!
+        @brief  Wake the threads parked in the blocking wait functions, if there are any,
+                after an index was published.
+    */
+    inline void notify_waiting() ALWAYS_INLINE_ATTR
+    {
+#if CIRCULAR_QUEUE_WAIT
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiting.load(std::memory_order_relaxed))
+        {
+            std::lock_guard<std::mutex> lock(m_waitMutex);
+            m_waitCv.notify_all();
+        }
+#endif
+    }
+
+#if CIRCULAR_QUEUE_WAIT
+    /*!
+        @brief  Poll ready for the spin budget, then flag a waiter and park in wait
+                until ready is true, or wait returns false on timeout.
+        @return The final result of ready.
+    */
+    template< typename Ready, typename Wait >
+    bool park(Ready ready, Wait wait)
+    {
+        for (auto spins = m_waitSpins; spins; --spins)
+        {
+            if (ready()) return true;
+        }
+        m_waiting.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool isReady;
+        {
+            std::unique_lock<std::mutex> lock(m_waitMutex);
+            while (!(isReady = ready()))
+            {
+                if (!wait(lock))
+                {
+                    isReady = ready();
+                    break;
+                }
+            }
+        }
+        m_waiting.fetch_sub(1);
+        return isReady;
+    }
+#endif
+
+    buffer_type m_buffer;
+#if CIRCULAR_QUEUE_WAIT
+    // Read on every publish, but only written when a thread parks.
+    std::atomic<unsigned> m_waiting{ 0 };
+    size_t m_waitSpins = CIRCULAR_QUEUE_WAIT_SPINS;
 #endif
-    std::atomic<size_t> m_inPos;
-    std::atomic<size_t> m_outPos;
+    // The producer's cache line: its index, and its private copy of the consumer index,
+    // which is only refreshed from m_outPos when the queue looks full.
+    alignas(GHOSTL_CACHELINE_SIZE) std::atomic<size_t> m_inPos;
+    size_t m_outPosCache;
+    bool m_pushpeeked;
+    // The consumer's cache line: its index, and its private copy of the producer index,
+    // which is only refreshed from m_inPos when the queue looks empty.
+    alignas(GHOSTL_CACHELINE_SIZE) std::atomic<size_t> m_outPos;
+    size_t m_inPosCache;
+#if CIRCULAR_QUEUE_STATS
+    // The counters written by the producers, and by the consumer, on separate cache lines.
+    alignas(GHOSTL_CACHELINE_SIZE) std::atomic<size_t> m_statPushes{ 0 };
+    std::atomic<size_t> m_statRejected{ 0 };
+    std::atomic<size_t> m_statHighWater{ 0 };
+    std::atomic<size_t> m_statHistogram[CIRCULAR_QUEUE_STATS_BUCKETS]{};
+    alignas(GHOSTL_CACHELINE_SIZE) std::atomic<size_t> m_statPops{ 0 };
+#endif
+#if CIRCULAR_QUEUE_WAIT
+    alignas(GHOSTL_CACHELINE_SIZE) std::mutex m_waitMutex;
+    std::condition_variable m_waitCv;
+#endif
+
+private:
+    template< size_t M >
+    bool reallocate(const size_t, detail::circular_queue_buffer<T, M, Allocator>*)
+    {
+        return false;
+    }
+    bool reallocate(const size_t cap, detail::circular_queue_buffer<T, 0, Allocator>* buffer);
 };
 
-template< typename T, typename ForEachArg >
-bool circular_queue<T, ForEachArg>::capacity(const size_t cap)
+template< typename T, typename ForEachArg, size_t N, class Allocator >
+bool circular_queue<T, ForEachArg, N, Allocator>::capacity(const size_t cap)
+{
+    if (cap == capacity()) return true;
+    else if (N || available() > cap) return false;
+    return reallocate(cap, &m_buffer);
+}
+
+template< typename T, typename ForEachArg, size_t N, class Allocator >
+bool circular_queue<T, ForEachArg, N, Allocator>::reallocate(const size_t cap, detail::circular_queue_buffer<T, 0, Allocator>* buffer)
 {
-    if (cap + 1 == m_bufSize) return true;
-    else if (available() > cap) return false;
-    std::unique_ptr<T[] > buffer(new T[cap + 1]);
-    const auto available = pop_n(buffer, cap);
-    m_buffer.reset(buffer);
-    m_bufSize = cap + 1;
+    detail::circular_queue_buffer<T, 0, Allocator> resized(cap + 1, buffer->allocator());
+    discard_pending();
+    size_t available = 0;
+    consume(cap, [&resized, &available](T& element)
+        {
+            new (resized.get() + available++) T(std::move(element));
+        });
+    *buffer = std::move(resized);
+#if CIRCULAR_QUEUE_STATS
+    // The elements were moved, not popped.
+    m_statPops.fetch_sub(available, std::memory_order_relaxed);
+#endif
     m_inPos.store(available, std::memory_order_relaxed);
+    m_outPosCache = 0;
     m_outPos.store(0, std::memory_order_relaxed);
+    m_inPosCache = available;
     return true;
 }
 
 #if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
-template< typename T, typename ForEachArg >
-size_t circular_queue<T, ForEachArg>::push_n(const T* buffer, size_t size)
+template< typename T, typename ForEachArg, size_t N, class Allocator >
+size_t circular_queue<T, ForEachArg, N, Allocator>::push_n(const T* buffer, size_t size)
 {
-    const auto inPos = m_inPos.load(std::memory_order_acquire);
-    const auto outPos = m_outPos.load(std::memory_order_relaxed);
-
-    size_t blockSize = (outPos > inPos) ? outPos - 1 - inPos : (outPos == 0) ? m_bufSize - 1 - inPos : m_bufSize - inPos;
-    blockSize = min(size, blockSize);
-    if (!blockSize) return 0;
-    int next = (inPos + blockSize) % m_bufSize;
+    const auto elements = reserve_write(size);
+    record_reject(size - elements.size());
+    if (!elements.size()) return 0;
 
-    auto dest = m_buffer.get() + inPos;
-    std::copy_n(std::make_move_iterator(buffer), blockSize, dest);
-    size = min(size - blockSize, outPos > 1 ? static_cast<size_t>(outPos - next - 1) : 0);
-    next += size;
-    dest = m_buffer.get();
-    std::copy_n(std::make_move_iterator(buffer + blockSize), size, dest);
+    detail::uninitialized_copy_n(buffer, elements.first.size, elements.first.data);
+    detail::uninitialized_copy_n(buffer + elements.first.size, elements.second.size, elements.second.data);
 
-    std::atomic_thread_fence(std::memory_order_release);
-    m_inPos.store(next, std::memory_order_release);
-    return blockSize + size;
+    commit_write(elements.size());
+    return elements.size();
 }
 #endif
 
-template< typename T, typename ForEachArg >
-T circular_queue<T, ForEachArg>::pop()
+template< typename T, typename ForEachArg, size_t N, class Allocator >
+typename circular_queue<T, ForEachArg, N, Allocator>::spans circular_queue<T, ForEachArg, N, Allocator>::reserve_write(size_t n)
+{
+    discard_pending();
+    const auto inPos = m_inPos.load(std::memory_order_relaxed);
+    if (capacity() - distance(m_outPosCache, inPos) < n)
+    {
+        m_outPosCache = m_outPos.load(std::memory_order_acquire);
+    }
+    n = min(n, capacity() - distance(m_outPosCache, inPos));
+    return split(inPos, n);
+}
+
+template< typename T, typename ForEachArg, size_t N, class Allocator >
+T circular_queue<T, ForEachArg, N, Allocator>::pop()
 {
-    const auto outPos = m_outPos.load(std::memory_order_acquire);
-    if (m_inPos.load(std::memory_order_relaxed) == outPos) return {};
+    const auto outPos = m_outPos.load(std::memory_order_relaxed);
+    if (m_inPosCache == outPos)
+    {
+        m_inPosCache = m_inPos.load(std::memory_order_acquire);
+        if (m_inPosCache == outPos) return {};
+    }
 
     std::atomic_thread_fence(std::memory_order_acquire);
 
-    auto val = std::move(m_buffer[outPos]);
+    T* const element = m_buffer.get() + slot(outPos);
+    T val(std::move(*element));
+    element->~T();
 
-    m_outPos.store((outPos + 1) % m_bufSize, std::memory_order_release);
+    m_outPos.store(advance(outPos, 1), std::memory_order_release);
+    record_pop(1);
+    notify_waiting();
     return val;
 }
 
 #if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
-template< typename T, typename ForEachArg >
-size_t circular_queue<T, ForEachArg>::pop_n(T* buffer, size_t size) {
-    size_t avail = size = min(size, available());
-    if (!avail) return 0;
-    const auto outPos = m_outPos.load(std::memory_order_acquire);
-    size_t n = min(avail, static_cast<size_t>(m_bufSize - outPos));
-
-    std::atomic_thread_fence(std::memory_order_acquire);
+template< typename T, typename ForEachArg, size_t N, class Allocator >
+size_t circular_queue<T, ForEachArg, N, Allocator>::pop_n(T* buffer, size_t size) {
+    const auto elements = reserve_read(size);
+    if (!elements.size()) return 0;
 
     if (buffer) {
-        buffer = std::copy_n(std::make_move_iterator(m_buffer.get() + outPos), n, buffer);
-        avail -= n;
-        std::copy_n(std::make_move_iterator(m_buffer.get()), avail, buffer);
+        detail::move_n(elements.first.data, elements.first.size, buffer);
+        detail::move_n(elements.second.data, elements.second.size, buffer + elements.first.size);
     }
 
-    m_outPos.store((outPos + size) % m_bufSize, std::memory_order_release);
-    return size;
+    commit_read(elements.size());
+    return elements.size();
 }
 #endif
 
-template< typename T, typename ForEachArg >
+template< typename T, typename ForEachArg, size_t N, class Allocator >
+typename circular_queue<T, ForEachArg, N, Allocator>::spans circular_queue<T, ForEachArg, N, Allocator>::reserve_read(size_t n)
+{
+    const auto outPos = m_outPos.load(std::memory_order_relaxed);
+    if (distance(outPos, m_inPosCache) < n)
+    {
+        m_inPosCache = m_inPos.load(std::memory_order_acquire);
+    }
+    n = min(n, distance(outPos, m_inPosCache));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return split(outPos, n);
+}
+
+template< typename T, typename ForEachArg, size_t N, class Allocator >
+constexpr size_t circular_queue<T, ForEachArg, N, Allocator>::npos;
+
+template< typename T, typename ForEachArg, size_t N, class Allocator >
+size_t circular_queue<T, ForEachArg, N, Allocator>::find_any(const T* values, size_t count)
+{
+    const auto elements = reserve_read(~static_cast<size_t>(0));
+    const auto pos = detail::find_any(static_cast<const T*>(elements.first.data), elements.first.size, values, count);
+    if (pos < elements.first.size) return pos;
+    const auto pos2 = detail::find_any(static_cast<const T*>(elements.second.data), elements.second.size, values, count);
+    return pos2 < elements.second.size ? elements.first.size + pos2 : npos;
+}
+
+template< typename T, typename ForEachArg, size_t N, class Allocator >
 #if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
-void circular_queue<T, ForEachArg>::for_each(const Delegate<void(T&&), ForEachArg>& fun)
+void circular_queue<T, ForEachArg, N, Allocator>::for_each(const Delegate<void(T&&), ForEachArg>& fun)
 #else
-void circular_queue<T, ForEachArg>::for_each(Delegate<void(T&&), ForEachArg> fun)
+void circular_queue<T, ForEachArg, N, Allocator>::for_each(Delegate<void(T&&), ForEachArg> fun)
 #endif
 {
-    auto outPos = m_outPos.load(std::memory_order_acquire);
-    const auto inPos = m_inPos.load(std::memory_order_relaxed);
-    std::atomic_thread_fence(std::memory_order_acquire);
+    auto outPos = m_outPos.load(std::memory_order_relaxed);
+    const auto inPos = m_inPosCache = m_inPos.load(std::memory_order_acquire);
     while (outPos != inPos)
     {
-        fun(std::move(m_buffer[outPos]));
-        outPos = (outPos + 1) % m_bufSize;
+        T* const element = m_buffer.get() + slot(outPos);
+        fun(std::move(*element));
+        element->~T();
+        outPos = advance(outPos, 1);
         m_outPos.store(outPos, std::memory_order_release);
+        record_pop(1);
     }
+    notify_waiting();
 }
 
-template< typename T, typename ForEachArg >
+template< typename T, typename ForEachArg, size_t N, class Allocator >
 #if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
-bool circular_queue<T, ForEachArg>::for_each_rev_requeue(const Delegate<bool(T&), ForEachArg>& fun)
+bool circular_queue<T, ForEachArg, N, Allocator>::for_each_rev_requeue(const Delegate<bool(T&), ForEachArg>& fun)
 #else
-bool circular_queue<T, ForEachArg>::for_each_rev_requeue(Delegate<bool(T&), ForEachArg> fun)
+bool circular_queue<T, ForEachArg, N, Allocator>::for_each_rev_requeue(Delegate<bool(T&), ForEachArg> fun)
 #endif
 {
-    auto inPos0 = circular_queue<T, ForEachArg>::m_inPos.load(std::memory_order_acquire);
-    auto outPos = circular_queue<T, ForEachArg>::m_outPos.load(std::memory_order_relaxed);
+    auto inPos0 = m_inPosCache = m_inPos.load(std::memory_order_acquire);
+    auto outPos = m_outPos.load(std::memory_order_relaxed);
     if (outPos == inPos0) return false;
     auto pos = inPos0;
     auto outPos1 = inPos0;
-    const auto posDecr = circular_queue<T, ForEachArg>::m_bufSize - 1;
     std::atomic_thread_fence(std::memory_order_acquire);
     do {
-        pos = (pos + posDecr) % circular_queue<T, ForEachArg>::m_bufSize;
-        T&& val = std::move(circular_queue<T, ForEachArg>::m_buffer[pos]);
-        if (fun(val))
+        pos = retreat(pos);
+        T* const element = m_buffer.get() + slot(pos);
+        if (fun(*element))
+        {
+            outPos1 = retreat(outPos1);
+            if (outPos1 != pos) relocate(m_buffer.get() + slot(outPos1), element);
+        }
+        else
         {
-            outPos1 = (outPos1 + posDecr) % circular_queue<T, ForEachArg>::m_bufSize;
-            if (outPos1 != pos) circular_queue<T, ForEachArg>::m_buffer[outPos1] = std::move(val);
+            element->~T();
         }
     } while (pos != outPos);
     std::atomic_thread_fence(std::memory_order_release);
-    circular_queue<T, ForEachArg>::m_outPos.store(outPos1, std::memory_order_release);
+    m_outPos.store(outPos1, std::memory_order_release);
+    record_pop(distance(outPos, outPos1));
+    notify_waiting();
     return true;
 }
 
@@ -0,0 +1,225 @@
+#pragma once
+/*
+circular_queue_broadcast.h - Implementation of a lock-free single-producer, multi-consumer broadcast ring.
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __circular_queue_broadcast_h
+#define __circular_queue_broadcast_h
+
+#include "circular_queue.h"
+
+#if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
+
+/*!
+    @brief  Instance class for a single-producer, multi-consumer broadcast ring buffer (FIFO),
+            in which every consumer sees every element. Each element is written once
+            into the ring buffer and read in place by all consumers, each of which has its
+            own read cursor, identified by its index. The producer is gated by the slowest
+            consumer, so every registered consumer must keep reading.
+            An element is destroyed when the producer reuses its slot, or with the queue.
+            This implementation is lock-free between producer and consumers.
+*/
+template< typename T >
+class circular_queue_broadcast
+{
+public:
+    /*!
+        @brief  Create a ring of at least the given capacity, rounded up to a power of two,
+                for the given number of consumers.
+    */
+    circular_queue_broadcast(const size_t capacity, const size_t consumers) :
+        m_buffer(pow2(capacity)), m_consumers(consumers), m_cursors(new cursor[consumers])
+    {
+        m_inPos.store(0);
+        m_outPosCache = 0;
+        m_full = false;
+        for (size_t i = 0; i < consumers; ++i)
+        {
+            m_cursors[i].outPos.store(0);
+            m_cursors[i].inPosCache = 0;
+        }
+    }
+    circular_queue_broadcast(const circular_queue_broadcast&) = delete;
+    circular_queue_broadcast& operator=(const circular_queue_broadcast&) = delete;
+    ~circular_queue_broadcast()
+    {
+        const size_t used = m_full ? m_buffer.size() : m_inPos.load();
+        for (size_t i = 0; i < used; ++i) m_buffer[i].~T();
+    }
+
+    /*!
+        @brief  Get the number of elements the ring holds before the producer is gated.
+    */
+    size_t capacity() const
+    {
+        return m_buffer.size();
+    }
+
+    /*!
+        @brief  Get the number of consumers.
+    */
+    size_t consumers() const
+    {
+        return m_consumers;
+    }
+
+    /*!
+        @brief  Get a snapshot number of elements that can be retrieved by the consumer.
+    */
+    size_t available(const size_t consumer) const
+    {
+        return m_inPos.load(std::memory_order_acquire) -
+            m_cursors[consumer].outPos.load(std::memory_order_relaxed);
+    }
+
+    /*!
+        @brief  Get the remaining free elements for pushing, as limited by the slowest consumer.
+    */
+    size_t available_for_push() const
+    {
+        return capacity() - (m_inPos.load(std::memory_order_relaxed) - min_outPos());
+    }
+
+    /*!
+        @brief  Move the rvalue parameter into the ring.
+        @return true if the ring accepted the value, false if the slowest consumer
+                has not yet read the element it would replace.
+    */
+    bool push(T&& val);
+
+    /*!
+        @brief  Push a copy of the parameter into the ring.
+        @return true if the ring accepted the value, false if the slowest consumer
+                has not yet read the element it would replace.
+    */
+    inline bool push(const T& val) ALWAYS_INLINE_ATTR
+    {
+        T v(val);
+        return push(std::move(v));
+    }
+
+    /*!
+        @brief  Peek at the next element the consumer's pop will return.
+        @return A copy of the element, or a default value of type T if none is available.
+    */
+    T peek(const size_t consumer) const
+    {
+        const auto outPos = m_cursors[consumer].outPos.load(std::memory_order_relaxed);
+        if (m_inPos.load(std::memory_order_acquire) == outPos) return {};
+        return m_buffer[outPos & (capacity() - 1)];
+    }
+
+    /*!
+        @brief  Pop the next available element for the consumer. The other consumers
+                still see the element.
+        @return A copy of the element, or a default value of type T if none is available.
+    */
+    T pop(const size_t consumer)
+    {
+        T val{};
+        consume(consumer, 1, [&val](const T& element) { val = element; });
+        return val;
+    }
+
+    /*!
+        @brief  Advance the consumer over up to max available elements in one batch,
+                calling back visitor with a const reference to every single element
+                in place. The consumer's cursor is published once, after the last
+                element was visited.
+        @return The number of elements that were consumed.
+    */
+    template< typename Visitor >
+    size_t consume(const size_t consumer, const size_t max, Visitor visitor);
+
+protected:
+    static size_t pow2(const size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        return size;
+    }
+
+    /*!
+        @brief  Get the read cursor of the slowest consumer.
+    */
+    size_t min_outPos() const
+    {
+        const auto inPos = m_inPos.load(std::memory_order_relaxed);
+        size_t lag = 0;
+        for (size_t i = 0; i < m_consumers; ++i)
+        {
+            lag = std::max(lag, inPos - m_cursors[i].outPos.load(std::memory_order_acquire));
+        }
+        return inPos - lag;
+    }
+
+    struct alignas(GHOSTL_CACHELINE_SIZE) cursor
+    {
+        std::atomic<size_t> outPos;
+        size_t inPosCache;
+    };
+
+    detail::circular_queue_buffer<T, 0> m_buffer;
+    const size_t m_consumers;
+    std::unique_ptr<cursor[]> m_cursors;
+
+    // Written by the producer; read by the consumers.
+    alignas(GHOSTL_CACHELINE_SIZE) std::atomic<size_t> m_inPos;
+    size_t m_outPosCache;
+    bool m_full;
+};
+
+template< typename T >
+bool circular_queue_broadcast<T>::push(T&& val)
+{
+    const auto inPos = m_inPos.load(std::memory_order_relaxed);
+    if (inPos - m_outPosCache == capacity())
+    {
+        m_outPosCache = min_outPos();
+        if (inPos - m_outPosCache == capacity()) return false;
+    }
+    T* const element = m_buffer.get() + (inPos & (capacity() - 1));
+    if (m_full) element->~T();
+    new (element) T(std::move(val));
+    if (inPos + 1 == capacity()) m_full = true;
+    m_inPos.store(inPos + 1, std::memory_order_release);
+    return true;
+}
+
+template< typename T >
+template< typename Visitor >
+size_t circular_queue_broadcast<T>::consume(const size_t consumer, const size_t max, Visitor visitor)
+{
+    cursor& c = m_cursors[consumer];
+    const auto outPos = c.outPos.load(std::memory_order_relaxed);
+    if (c.inPosCache - outPos < max)
+    {
+        c.inPosCache = m_inPos.load(std::memory_order_acquire);
+    }
+    const size_t n = min(max, c.inPosCache - outPos);
+    for (size_t i = 0; i < n; ++i)
+    {
+        visitor(static_cast<const T&>(m_buffer[(outPos + i) & (capacity() - 1)]));
+    }
+    if (n) c.outPos.store(outPos + n, std::memory_order_release);
+    return n;
+}
+
+#endif
+
+#endif // __circular_queue_broadcast_h
@@ -0,0 +1,142 @@
+#pragma once
+/*
+circular_queue_codel.h - Implementation of a lock-free circular queue with sojourn times and CoDel active queue management.
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __circular_queue_codel_h
+#define __circular_queue_codel_h
+
+#include "circular_queue_mp.h"
+#include "codel.h"
+
+/*!
+    @brief  Instance class for a multi-producer, single-consumer circular queue / ring buffer (FIFO)
+            that stamps each element on push, and reports its sojourn time on pop.
+            By default, it drops nothing. With the codel Policy, see circular_queue_mp_codel,
+            it acts against standing queues: under overload, the consumer drops stale elements,
+            or producers reject new ones, so latency stays bounded.
+            This implementation is lock-free between producers and consumer.
+*/
+template< typename T, size_t N = 0, class Policy = no_drop >
+class circular_queue_mp_sojourn
+{
+public:
+    circular_queue_mp_sojourn(const Policy& policy = Policy()) : m_policy(policy)
+    {
+        m_sojourn = 0;
+        m_dropped = 0;
+    }
+    circular_queue_mp_sojourn(const size_t capacity, const Policy& policy = Policy()) :
+        m_queue(capacity), m_policy(policy)
+    {
+        m_sojourn = 0;
+        m_dropped = 0;
+    }
+
+    size_t capacity() const
+    {
+        return m_queue.capacity();
+    }
+    bool capacity(const size_t cap)
+    {
+        return m_queue.capacity(cap);
+    }
+    size_t available() const
+    {
+        return m_queue.available();
+    }
+    size_t available_for_push() const
+    {
+        return m_queue.available_for_push();
+    }
+
+    /*!
+        @brief  Move the rvalue parameter into the queue, stamped with the current time,
+                guarded for multiple concurrent producers.
+        @return true if the queue accepted the value, false if the queue was full,
+                or the rejecting policy is in its dropping state.
+    */
+    bool push(T&& val)
+    {
+        if (m_policy.rejecting()) return false;
+        return m_queue.push({ std::move(val), sojourn_now() });
+    }
+
+    /*!
+        @brief  Push a copy of the parameter into the queue, see push(T&&).
+    */
+    inline bool push(const T& val) ALWAYS_INLINE_ATTR
+    {
+        T v(val);
+        return push(std::move(v));
+    }
+
+    /*!
+        @brief  Pop the next element from the queue that the policy does not drop.
+        @return An rvalue copy of the popped element, or a default
+                value of type T if the queue is empty.
+    */
+    T pop()
+    {
+        while (m_queue.available())
+        {
+            auto element = m_queue.pop();
+            const auto now = sojourn_now();
+            m_sojourn = now - element.stamp;
+            if (!m_policy.should_drop(m_sojourn, now, !m_queue.available())) return std::move(element.item);
+            ++m_dropped;
+        }
+        return {};
+    }
+
+    /*!
+        @brief  Get the sojourn time in microseconds of the element that was popped last.
+    */
+    uint32_t sojourn() const
+    {
+        return m_sojourn;
+    }
+
+    /*!
+        @brief  Get the number of elements the policy has dropped.
+    */
+    size_t dropped() const
+    {
+        return m_dropped;
+    }
+
+    const Policy& policy() const
+    {
+        return m_policy;
+    }
+
+protected:
+    circular_queue_mp<sojourn_stamped<T>, void, N> m_queue;
+    Policy m_policy;
+    // Owned by the consumer.
+    uint32_t m_sojourn;
+    size_t m_dropped;
+};
+
+/*!
+    @brief  A circular_queue_mp_sojourn with CoDel active queue management.
+*/
+template< typename T, size_t N = 0 >
+using circular_queue_mp_codel = circular_queue_mp_sojourn<T, N, codel>;
+
+#endif // __circular_queue_codel_h
@@ -0,0 +1,232 @@
+#pragma once
+/*
+circular_queue_lossy.h - Implementation of a lock-free circular queue that overwrites its oldest elements.
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __circular_queue_lossy_h
+#define __circular_queue_lossy_h
+
+#include "circular_queue.h"
+#include "backoff.h"
+
+#if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
+#include <cstddef>
+#include <type_traits>
+
+/*!
+    @brief  Instance class for a multi-producer, single-consumer circular queue / ring buffer (FIFO)
+            that keeps the newest elements. push() never fails: when the queue is full,
+            it overwrites the oldest element. Every element carries the sequence number of
+            its push, so the consumer can tell how many elements it missed.
+            Each slot is guarded by a sequence lock, the consumer copies an element and
+            discards the copy if a producer overwrote the slot meanwhile, therefore
+            T must be trivially copyable. A producer that laps a push still being written
+            does not wait for it, but drops its own element, which the consumer counts as lost.
+            A producer that loses a race for its slot retries after the Backoff policy, see backoff.h.
+*/
+template< typename T, class Backoff = ghostl::default_backoff >
+class circular_queue_lossy
+{
+    static_assert(std::is_trivially_copyable<T>::value, "circular_queue_lossy requires a trivially copyable T");
+
+public:
+    /*!
+        @brief  Create a queue of at least the given capacity, rounded up to a power of two.
+                There is no queue without capacity, as push() always stores its element.
+    */
+    explicit circular_queue_lossy(const size_t capacity) :
+        m_mask(pow2(capacity) - 1), m_buffer(new slot_t[m_mask + 1])
+    {
+        for (size_t i = 0; i <= m_mask; ++i)
+        {
+            m_buffer[i].seq.store(0, std::memory_order_relaxed);
+            m_buffer[i].skipped.store(0, std::memory_order_relaxed);
+        }
+        m_inPos.store(0);
+        m_outPos = 0;
+        m_lost = 0;
+    }
+    circular_queue_lossy(const circular_queue_lossy&) = delete;
+    circular_queue_lossy& operator=(const circular_queue_lossy&) = delete;
+
+    /*!
+        @brief  Get the number of elements the queue holds at most before it overwrites any.
+    */
+    size_t capacity() const
+    {
+        return m_mask + 1;
+    }
+
+    /*!
+        @brief  Get a snapshot number of elements that the consumer can retrieve by pop,
+                at most capacity().
+    */
+    size_t available() const
+    {
+        return min(m_inPos.load(std::memory_order_acquire) - m_outPos, capacity());
+    }
+
+    /*!
+        @brief  Get the number of elements the consumer has missed because they were overwritten
+                before it could pop them.
+    */
+    size_t lost() const
+    {
+        return m_lost;
+    }
+
+    /*!
+        @brief  Copy the parameter into the queue, overwriting the oldest element if the queue
+                is full. This is safe for multiple producers, and never waits for another one:
+                in the rare case that the oldest element's slot is still being written by a
+                producer that has since been lapped, this push is dropped and counted in lost().
+        @return The sequence number of the pushed element.
+    */
+    size_t push(const T& val);
+
+    /*!
+        @brief  Pop the next available element from the queue, skipping over missed ones.
+        @param  val The popped element is copied to this.
+        @param  seq Receives the sequence number of the popped element. The difference to
+                the previous one, minus one, is the number of elements missed in between.
+        @return true if an element was popped, false if the queue is empty.
+    */
+    bool pop(T& val, size_t& seq);
+
+    /*!
+        @brief  Pop the next available element from the queue, skipping over missed ones.
+        @return true if an element was popped to val, false if the queue is empty.
+    */
+    bool pop(T& val)
+    {
+        size_t seq;
+        return pop(val, seq);
+    }
+
+    /*!
+        @brief  Discard all data in the queue.
+    */
+    void flush()
+    {
+        m_outPos = m_inPos.load(std::memory_order_acquire);
+    }
+
+protected:
+    /*!
+        @brief  A slot's sequence lock is odd while the element with sequence number
+                (seq - 1) / 2 is written, and even once the element with sequence number
+                seq / 2 - 1 is complete. skipped is one past the sequence number of the latest
+                push that was dropped because the slot was still being written.
+    */
+    struct slot_t
+    {
+        std::atomic<size_t> seq;
+        std::atomic<size_t> skipped;
+        T val;
+    };
+
+    static size_t pow2(const size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        return size;
+    }
+
+    // Compare sequence lock values with wrap-around.
+    static inline bool before(const size_t a, const size_t b) ALWAYS_INLINE_ATTR
+    {
+        return static_cast<std::ptrdiff_t>(a - b) < 0;
+    }
+
+    const size_t m_mask;
+    const std::unique_ptr<slot_t[]> m_buffer;
+
+    // Claimed by the producers, one sequence number per push.
+    alignas(GHOSTL_CACHELINE_SIZE) std::atomic<size_t> m_inPos;
+    // Owned by the consumer.
+    alignas(GHOSTL_CACHELINE_SIZE) size_t m_outPos;
+    size_t m_lost;
+};
+
+template< typename T, class Backoff >
+size_t IRAM_ATTR circular_queue_lossy<T, Backoff>::push(const T& val)
+{
+    const size_t inPos = m_inPos.fetch_add(1, std::memory_order_relaxed);
+    slot_t& slot = m_buffer[inPos & m_mask];
+    const size_t writing = 2 * inPos + 1;
+    size_t seq = slot.seq.load(std::memory_order_relaxed);
+    for (Backoff backoff;; backoff())
+    {
+        // A producer that claimed a later lap of this slot has superseded this push.
+        if (!before(seq, writing)) return inPos;
+        // A lapped producer is still writing the slot, drop this push rather than wait for it.
+        if (seq & 1)
+        {
+            size_t skipped = slot.skipped.load(std::memory_order_relaxed);
+            while (before(skipped, inPos + 1) &&
+                !slot.skipped.compare_exchange_weak(skipped, inPos + 1, std::memory_order_release, std::memory_order_relaxed)) {}
+            return inPos;
+        }
+        if (slot.seq.compare_exchange_weak(seq, writing, std::memory_order_relaxed)) break;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.val = val;
+    slot.seq.store(writing + 1, std::memory_order_release);
+    return inPos;
+}
+
+template< typename T, class Backoff >
+bool circular_queue_lossy<T, Backoff>::pop(T& val, size_t& seq)
+{
+    for (;;)
+    {
+        const size_t inPos = m_inPos.load(std::memory_order_acquire);
+        if (inPos == m_outPos) return false;
+        if (inPos - m_outPos > capacity())
+        {
+            m_lost += inPos - m_outPos - capacity();
+            m_outPos = inPos - capacity();
+        }
+        slot_t& slot = m_buffer[m_outPos & m_mask];
+        const size_t complete = 2 * m_outPos + 2;
+        const size_t seq1 = slot.seq.load(std::memory_order_acquire);
+        if (before(seq1, complete))
+        {
+            // The claimed element is still being written, or its producer has yet to write or drop it.
+            if (seq1 == complete - 1 || before(slot.skipped.load(std::memory_order_acquire), m_outPos + 1)) return false;
+        }
+        else if (seq1 == complete)
+        {
+            T copy = slot.val;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) == complete)
+            {
+                val = copy;
+                seq = m_outPos++;
+                return true;
+            }
+        }
+        // Overwritten by a later lap, or dropped.
+        ++m_lost;
+        ++m_outPos;
+    }
+}
+
+#endif
+
+#endif // __circular_queue_lossy_h
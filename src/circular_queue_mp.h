@@ -22,62 +22,229 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #define __circular_queue_mp_h
 
 #include "circular_queue.h"
+#include "backoff.h"
+#include "contention.h"
 
 #if defined(ESP8266)
 #include <interrupts.h>
 using esp8266::InterruptLock;
 #endif
 
+#if GHOSTL_CONTENTION_STATS
+/*!
+    @brief  A snapshot of the contention counters of a circular_queue_mp.
+*/
+struct circular_queue_mp_contention
+{
+    // The number of failed compare-exchanges while claiming or publishing slots,
+    // and of slot reservations that were given back because the queue filled up.
+    size_t cas_failures;
+    // The number of pushes rejected because the queue was full.
+    size_t rejections;
+    // The number of pushes that left their element to be published by
+    // another concurrent producer.
+    size_t publish_delays;
+};
+#endif
+
+namespace detail
+{
+#if !defined(ESP8266) && !defined(ESP32) && defined(ARDUINO)
+    // MultiDelegate.h defines a global InterruptLock on this platform too.
+    class circular_queue_mp_lock
+    {
+    public:
+        circular_queue_mp_lock() {
+            noInterrupts();
+        }
+        ~circular_queue_mp_lock() {
+            interrupts();
+        }
+    };
+#elif defined(ESP8266)
+    using circular_queue_mp_lock = esp8266::InterruptLock;
+#endif
+
+    struct circular_queue_mp_uncontended
+    {
+        inline void operator()() const {}
+    };
+
+    /*!
+        @brief  The protocol by which the producers of a multi-producer queue claim and publish
+                their slots. A producer claims slots by advancing the shared claim index inPos_mp,
+                and then counts as concurrent producer until it publishes. The last of the
+                concurrent producers to publish stores inPos_mp into the consumer's view
+                of the queue, inPos, so the consumer never sees a slot before it is filled.
+                On AVR and ESP8266, a short interrupt lock replaces the atomic read-modify-writes.
+                Lost races are retried after the Backoff policy, and reported to contended().
+    */
+    template< class Backoff >
+    struct circular_queue_mp_protocol
+    {
+        /*!
+            @brief  Enter the concurrent producers, and claim slots at the claim index.
+                    reserve(pos, next) returns the amount of free space at queue index pos that
+                    it claims, up to the requested amount, and sets next to the claim index
+                    behind it, or returns 0 if there is none. It must get the consumer's index with
+                    an acquire load, to order the reuse of slots after the consumer has read them.
+                    The producer must publish() in any case.
+            @return The claimed amount, beginning at queue index pos, or 0 if the queue was full.
+        */
+        template< typename Reserve, typename Contended = circular_queue_mp_uncontended >
+        static size_t IRAM_ATTR claim(std::atomic<size_t>& inPos_mp, std::atomic<int>& concurrent_mp,
+            size_t& pos, Reserve reserve, Contended contended = Contended())
+        {
+            size_t next;
+#if !defined(ESP32) && defined(ARDUINO)
+            (void)contended;
+            circular_queue_mp_lock lock;
+            concurrent_mp.store(concurrent_mp.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+            pos = inPos_mp.load(std::memory_order_relaxed);
+            const size_t claimed = reserve(pos, next);
+            if (claimed) inPos_mp.store(next, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            return claimed;
+#else
+            ++concurrent_mp;
+            Backoff backoff;
+            for (;;)
+            {
+                pos = inPos_mp.load(std::memory_order_relaxed);
+                const size_t claimed = reserve(pos, next);
+                if (!claimed || inPos_mp.compare_exchange_weak(pos, next)) return claimed;
+                contended();
+                backoff();
+            }
+#endif
+        }
+
+        /*!
+            @brief  Leave the concurrent producers. The last one to leave publishes
+                    the slots that all of them have claimed and filled in the meantime.
+            @return true if this producer published, false if it left that to another one.
+        */
+        template< typename Contended = circular_queue_mp_uncontended >
+        static bool IRAM_ATTR publish(std::atomic<size_t>& inPos_mp, std::atomic<int>& concurrent_mp,
+            std::atomic<size_t>& inPos, Contended contended = Contended())
+        {
+#if !defined(ESP32) && defined(ARDUINO)
+            (void)contended;
+            circular_queue_mp_lock lock;
+            const bool last = 1 == concurrent_mp.load(std::memory_order_relaxed);
+            if (last) inPos.store(inPos_mp.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            concurrent_mp.store(concurrent_mp.load(std::memory_order_relaxed) - 1,
+                std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            return last;
+#else
+            Backoff backoff;
+            for (;;)
+            {
+                const auto claimed = inPos_mp.load();
+                auto concurrent = concurrent_mp.load();
+                if (1 == concurrent)
+                {
+                    inPos.store(claimed, std::memory_order_release);
+                }
+                if (concurrent_mp.compare_exchange_weak(concurrent, concurrent - 1)) return 1 == concurrent;
+                contended();
+                backoff();
+            }
+#endif
+        }
+    };
+}
+
 /*!
     @brief  Instance class for a multi-producer, single-consumer circular queue / ring buffer (FIFO).
             This implementation is lock-free between producers and consumer for the available(), peek(),
             pop(), and push() type functions.
+            With free-running queue indices, that is, a power-of-two capacity N, or
+            CIRCULAR_QUEUE_MONOTONIC_INDICES, producers claim slots by fetch_add and never retry
+            against each other. A queue with a capacity that is set at runtime, or any other N,
+            has wrapping indices, which cannot be advanced by fetch_add, so its producers claim
+            slots by a compare-exchange loop. On 64-bit targets, CIRCULAR_QUEUE_MONOTONIC_INDICES
+            makes these queues lock-free at claiming too.
+            Either way, the last of a group of concurrent producers publishes their slots by
+            a compare-exchange, which fails only if yet another producer has joined meanwhile.
+            Producers that lose a race for the queue indices retry after the Backoff policy, see backoff.h.
 */
-template< typename T, typename ForEachArg = void >
-class circular_queue_mp : protected circular_queue<T, ForEachArg>
+template< typename T, typename ForEachArg = void, size_t N = 0, class Allocator = detail::circular_queue_allocator<T>,
+    class Backoff = ghostl::default_backoff >
+class circular_queue_mp : protected circular_queue<T, ForEachArg, N, Allocator>
 {
 public:
-    circular_queue_mp() : circular_queue<T, ForEachArg>()
+    circular_queue_mp() : circular_queue<T, ForEachArg, N, Allocator>()
     {
         m_inPos_mp.store(0);
         m_concurrent_mp.store(0);
+        m_reserved_mp.store(0);
     }
-    circular_queue_mp(const size_t capacity) : circular_queue<T, ForEachArg>(capacity)
+    circular_queue_mp(const size_t capacity, const Allocator& alloc = Allocator()) :
+        circular_queue<T, ForEachArg, N, Allocator>(capacity, alloc)
     {
         m_inPos_mp.store(0);
         m_concurrent_mp.store(0);
+        m_reserved_mp.store(0);
     }
-    circular_queue_mp(circular_queue_mp<T, ForEachArg>&& cq) : circular_queue<T, ForEachArg>(std::move(cq))
+    circular_queue_mp(circular_queue_mp&& cq) : circular_queue<T, ForEachArg, N, Allocator>(std::move(cq))
     {
         m_inPos_mp.store(cq.m_inPos_mp.load());
         m_concurrent_mp.store(cq.m_concurrent_mp.load());
+        m_reserved_mp.store(cq.m_reserved_mp.load());
     }
     circular_queue_mp& operator=(circular_queue_mp&& cq)
     {
-        circular_queue<T, ForEachArg>::operator=(std::move(cq));
+        circular_queue<T, ForEachArg, N, Allocator>::operator=(std::move(cq));
         m_inPos_mp.store(cq.m_inPos_mp.load());
         m_concurrent_mp.store(cq.m_concurrent_mp.load());
+        m_reserved_mp.store(cq.m_reserved_mp.load());
+        return *this;
     }
     circular_queue_mp& operator=(const circular_queue_mp&) = delete;
 
-    using circular_queue<T, ForEachArg>::capacity;
-    using circular_queue<T, ForEachArg>::flush;
-    using circular_queue<T, ForEachArg>::peek;
-    using circular_queue<T, ForEachArg>::pop;
-    using circular_queue<T, ForEachArg>::pop_n;
-    using circular_queue<T, ForEachArg>::for_each;
-    using circular_queue<T, ForEachArg>::for_each_rev_requeue;
+    using circular_queue<T, ForEachArg, N, Allocator>::capacity;
+    using circular_queue<T, ForEachArg, N, Allocator>::flush;
+    using circular_queue<T, ForEachArg, N, Allocator>::peek;
+    using circular_queue<T, ForEachArg, N, Allocator>::pop;
+    using circular_queue<T, ForEachArg, N, Allocator>::pop_n;
+    using circular_queue<T, ForEachArg, N, Allocator>::reserve_read;
+    using circular_queue<T, ForEachArg, N, Allocator>::commit_read;
+    using circular_queue<T, ForEachArg, N, Allocator>::consume;
+    using circular_queue<T, ForEachArg, N, Allocator>::find;
+    using circular_queue<T, ForEachArg, N, Allocator>::find_any;
+    using circular_queue<T, ForEachArg, N, Allocator>::npos;
+    using circular_queue<T, ForEachArg, N, Allocator>::for_each;
+    using circular_queue<T, ForEachArg, N, Allocator>::for_each_rev_requeue;
+    using circular_queue<T, ForEachArg, N, Allocator>::push_sequence;
+    using circular_queue<T, ForEachArg, N, Allocator>::pop_sequence;
+#if CIRCULAR_QUEUE_STATS
+    using circular_queue<T, ForEachArg, N, Allocator>::stats;
+#endif
+#if CIRCULAR_QUEUE_WAIT
+    using circular_queue<T, ForEachArg, N, Allocator>::pop_wait;
+    using circular_queue<T, ForEachArg, N, Allocator>::pop_wait_until;
+    using circular_queue<T, ForEachArg, N, Allocator>::pop_wait_for;
+    using circular_queue<T, ForEachArg, N, Allocator>::wait_spins;
+#endif
+
+    using typename circular_queue<T, ForEachArg, N, Allocator>::span;
+    using typename circular_queue<T, ForEachArg, N, Allocator>::spans;
 
     T& pushpeek() = delete;
     bool push() = delete;
+    spans reserve_write(size_t n) = delete;
+    void commit_write(const size_t k) = delete;
 
     inline size_t IRAM_ATTR available() const ALWAYS_INLINE_ATTR
     {
-        return circular_queue<T, ForEachArg>::available();
+        return circular_queue<T, ForEachArg, N, Allocator>::available();
     }
     inline size_t IRAM_ATTR available_for_push() const ALWAYS_INLINE_ATTR
     {
-        return circular_queue<T, ForEachArg>::available_for_push();
+        return circular_queue<T, ForEachArg, N, Allocator>::available_for_push();
     }
 
     /*!
@@ -120,193 +287,241 @@ public:
     size_t push_n(const T* buffer, size_t size);
 #endif
 
+#if GHOSTL_CONTENTION_STATS
+    /*!
+        @brief  Get a snapshot of the contention counters of the queue.
+    */
+    circular_queue_mp_contention contention() const
+    {
+        circular_queue_mp_contention snapshot;
+        snapshot.cas_failures = m_contention_mp[contention_cas_failure];
+        snapshot.rejections = m_contention_mp[contention_rejection];
+        snapshot.publish_delays = m_contention_mp[contention_publish_delay];
+        return snapshot;
+    }
+#endif
+
+#if CIRCULAR_QUEUE_WAIT
+    /*!
+        @brief  Move the rvalue parameter into the queue, blocking while the queue is full,
+                guarded for multiple concurrent producers.
+    */
+    void push_wait(T&& val)
+    {
+        while (!push(std::move(val)))
+        {
+            circular_queue<T, ForEachArg, N, Allocator>::park([this]() { return available_for_push() > 0; },
+                [this](std::unique_lock<std::mutex>& lock)
+                {
+                    circular_queue<T, ForEachArg, N, Allocator>::m_waitCv.wait(lock);
+                    return true;
+                });
+        }
+    }
+
+    /*!
+        @brief  Push a copy of the parameter into the queue, blocking while the queue is full,
+                guarded for multiple concurrent producers.
+    */
+    inline void push_wait(const T& val) ALWAYS_INLINE_ATTR
+    {
+        T v(val);
+        push_wait(std::move(v));
+    }
+
+    /*!
+        @brief  Move the rvalue parameter into the queue, blocking while the queue is full,
+                until the deadline passes, guarded for multiple concurrent producers.
+        @return true if the queue accepted the value, false if the deadline passed first.
+    */
+    template< typename Clock, typename Duration >
+    bool push_wait_until(T&& val, const std::chrono::time_point<Clock, Duration>& deadline)
+    {
+        while (!push(std::move(val)))
+        {
+            if (!circular_queue<T, ForEachArg, N, Allocator>::park([this]() { return available_for_push() > 0; },
+                [this, &deadline](std::unique_lock<std::mutex>& lock)
+                {
+                    return circular_queue<T, ForEachArg, N, Allocator>::m_waitCv.wait_until(lock, deadline) == std::cv_status::no_timeout;
+                })) return false;
+        }
+        return true;
+    }
+
+    /*!
+        @brief  Move the rvalue parameter into the queue, blocking while the queue is full,
+                for at most the given timeout, guarded for multiple concurrent producers.
+        @return true if the queue accepted the value, false if the timeout expired first.
+    */
+    template< typename Rep, typename Period >
+    inline bool push_wait_for(T&& val, const std::chrono::duration<Rep, Period>& timeout)
+    {
+        return push_wait_until(std::move(val), std::chrono::steady_clock::now() + timeout);
+    }
+#endif
+
 protected:
+    using protocol = detail::circular_queue_mp_protocol<Backoff>;
+
+    /*!
+        @brief  Claim up to n free slots for the calling producer, which then counts
+                as concurrent producer until it calls publish().
+                With free-running indices, the producer checks for free slots, then reserves
+                them by fetch_add, and gives back the part of its reservation that a concurrent
+                producer has taken meanwhile. For that short while, the reservations of both may
+                exceed the capacity, and a third producer may find the queue full, although it
+                would have had room for it once the excess is given back.
+        @return The number of claimed slots, beginning at queue index pos,
+                or 0 if the queue was full.
+    */
+    size_t claim(size_t n, size_t& pos);
+
+    /*!
+        @brief  Leave the concurrent producers. The last one to leave publishes
+                the slots that all of them have claimed and filled in the meantime.
+                filled is false for a producer that has claimed no slot.
+    */
+    void publish(const bool filled = true);
+
+    enum contention_event
+    {
+        contention_cas_failure,
+        contention_rejection,
+        contention_publish_delay,
+        contention_events
+    };
+
+    /*!
+        @brief  Count a contention event, if GHOSTL_CONTENTION_STATS is enabled.
+    */
+    inline void contended(const contention_event event) ALWAYS_INLINE_ATTR
+    {
+#if GHOSTL_CONTENTION_STATS
+        m_contention_mp.count(event);
+#else
+        (void)event;
+#endif
+    }
+
     std::atomic<size_t> m_inPos_mp;
     std::atomic<int> m_concurrent_mp;
+    // Free-running count of the slots reserved by producers, including the transient
+    // excess of reservations that are being undone, for queues with free-running indices.
+    std::atomic<size_t> m_reserved_mp;
+#if GHOSTL_CONTENTION_STATS
+    ghostl::contention_counters<contention_events> m_contention_mp;
+#endif
 };
 
-template< typename T, typename ForEachArg >
-bool circular_queue_mp<T, ForEachArg>::capacity(const size_t cap)
+template< typename T, typename ForEachArg, size_t N, class Allocator, class Backoff >
+bool circular_queue_mp<T, ForEachArg, N, Allocator, Backoff>::capacity(const size_t cap)
 {
-    if (cap + 1 == circular_queue<T, ForEachArg>::m_bufSize) return true;
-    else if (!circular_queue<T, ForEachArg>::capacity(cap)) return false;
-    m_inPos_mp.store(circular_queue<T, ForEachArg>::m_inPos.load(std::memory_order_relaxed),
+    if (cap == circular_queue<T, ForEachArg, N, Allocator>::capacity()) return true;
+    else if (!circular_queue<T, ForEachArg, N, Allocator>::capacity(cap)) return false;
+    m_inPos_mp.store(circular_queue<T, ForEachArg, N, Allocator>::m_inPos.load(std::memory_order_relaxed),
         std::memory_order_relaxed);
+    m_reserved_mp.store(m_inPos_mp.load(std::memory_order_relaxed), std::memory_order_relaxed);
     m_concurrent_mp.store(0, std::memory_order_relaxed);
     return true;
 }
 
-template< typename T, typename ForEachArg >
-bool IRAM_ATTR circular_queue_mp<T, ForEachArg>::push(T&& val)
+template< typename T, typename ForEachArg, size_t N, class Allocator, class Backoff >
+size_t IRAM_ATTR circular_queue_mp<T, ForEachArg, N, Allocator, Backoff>::claim(size_t n, size_t& pos)
 {
-    size_t inPos_mp;
-    size_t next;
-#if !defined(ESP32) && defined(ARDUINO)
-    class InterruptLock {
-    public:
-        InterruptLock() {
-            noInterrupts();
-        }
-        ~InterruptLock() {
-            interrupts();
-        }
-    };
+#if defined(ESP32) || !defined(ARDUINO)
+    if (circular_queue<T, ForEachArg, N, Allocator>::monotonic)
     {
-        InterruptLock lock;
-#else
-    ++m_concurrent_mp;
-    do
-    {
-#endif
-        inPos_mp = m_inPos_mp.load(std::memory_order_relaxed);
-        next = (inPos_mp + 1) % circular_queue<T, ForEachArg>::m_bufSize;
-        if (next == circular_queue<T, ForEachArg>::m_outPos.load(std::memory_order_relaxed)) {
-#if !defined(ESP32) && defined(ARDUINO)
-            return false;
-        }
-        m_inPos_mp.store(next, std::memory_order_relaxed);
-        m_concurrent_mp.store(m_concurrent_mp.load(std::memory_order_relaxed) + 1,
-            std::memory_order_relaxed);
-        std::atomic_thread_fence(std::memory_order_release);
-    }
-#else
-            int concurrent_mp;
-            do
-            {
-                inPos_mp = m_inPos_mp.load();
-                concurrent_mp = m_concurrent_mp.load();
-                if (1 == concurrent_mp)
-                {
-                    circular_queue<T, ForEachArg>::m_inPos.store(inPos_mp, std::memory_order_release);
-                }
-            }
-            while (!m_concurrent_mp.compare_exchange_weak(concurrent_mp, concurrent_mp - 1));
-            return false;
+        // Reserve the slots by a single fetch_add, and give back any excess if the queue
+        // filled up in the meantime, so that producers never retry against each other.
+        const auto outPos = circular_queue<T, ForEachArg, N, Allocator>::m_outPos.load(std::memory_order_acquire);
+        const auto capacity = circular_queue<T, ForEachArg, N, Allocator>::capacity();
+        n = min(n, capacity - min(capacity, m_reserved_mp.load(std::memory_order_relaxed) - outPos));
+        if (!n) return 0;
+        const auto used = m_reserved_mp.fetch_add(n, std::memory_order_relaxed) + n - outPos;
+        const auto excess = used > capacity ? min(n, used - capacity) : 0;
+        if (excess)
+        {
+            contended(contention_cas_failure);
+            m_reserved_mp.fetch_sub(excess, std::memory_order_relaxed);
+            n -= excess;
+            if (!n) return 0;
         }
+        // The slots are reserved, the ticket for them cannot fail.
+        ++m_concurrent_mp;
+        pos = m_inPos_mp.fetch_add(n);
+        return n;
     }
-    while (!m_inPos_mp.compare_exchange_weak(inPos_mp, next));
 #endif
 
-    circular_queue<T, ForEachArg>::m_buffer[inPos_mp] = std::move(val);
-
-    std::atomic_thread_fence(std::memory_order_release);
+    // Wrapping queue indices cannot be advanced by fetch_add.
+    const auto claimed = protocol::claim(m_inPos_mp, m_concurrent_mp, pos,
+        [this, n](const size_t inPos_mp, size_t& next) -> size_t
+        {
+            const auto used = circular_queue<T, ForEachArg, N, Allocator>::distance(
+                circular_queue<T, ForEachArg, N, Allocator>::m_outPos.load(std::memory_order_acquire), inPos_mp);
+            const auto room = circular_queue<T, ForEachArg, N, Allocator>::capacity() - min(used,
+                circular_queue<T, ForEachArg, N, Allocator>::capacity());
+            next = circular_queue<T, ForEachArg, N, Allocator>::advance(inPos_mp, min(n, room));
+            return min(n, room);
+        },
+        [this]() { contended(contention_cas_failure); });
+    if (!claimed) publish(false);
+    return claimed;
+}
 
-#if !defined(ESP32) && defined(ARDUINO)
+template< typename T, typename ForEachArg, size_t N, class Allocator, class Backoff >
+void IRAM_ATTR circular_queue_mp<T, ForEachArg, N, Allocator, Backoff>::publish(const bool filled)
+{
+    if (!protocol::publish(m_inPos_mp, m_concurrent_mp, circular_queue<T, ForEachArg, N, Allocator>::m_inPos,
+        [this]() { contended(contention_cas_failure); }) && filled)
     {
-        InterruptLock lock;
-        if (1 == m_concurrent_mp.load(std::memory_order_relaxed))
-        {
-            inPos_mp = m_inPos_mp.load(std::memory_order_relaxed);
-            circular_queue<T, ForEachArg>::m_inPos.store(inPos_mp, std::memory_order_relaxed);
-        }
-        m_concurrent_mp.store(m_concurrent_mp.load(std::memory_order_relaxed) - 1,
-            std::memory_order_relaxed);
-        std::atomic_thread_fence(std::memory_order_release);
+        contended(contention_publish_delay);
     }
-#else
-    int concurrent_mp;
-    do
+    circular_queue<T, ForEachArg, N, Allocator>::notify_waiting();
+}
+
+template< typename T, typename ForEachArg, size_t N, class Allocator, class Backoff >
+bool IRAM_ATTR circular_queue_mp<T, ForEachArg, N, Allocator, Backoff>::push(T&& val)
+{
+    size_t inPos_mp;
+    if (!claim(1, inPos_mp))
     {
-        inPos_mp = m_inPos_mp.load();
-        concurrent_mp = m_concurrent_mp.load();
-        if (1 == concurrent_mp)
-        {
-            circular_queue<T, ForEachArg>::m_inPos.store(inPos_mp, std::memory_order_release);
-        }
+        contended(contention_rejection);
+        circular_queue<T, ForEachArg, N, Allocator>::record_reject(1);
+        return false;
     }
-    while (!m_concurrent_mp.compare_exchange_weak(concurrent_mp, concurrent_mp - 1));
-#endif
 
+    new (circular_queue<T, ForEachArg, N, Allocator>::m_buffer.get() + circular_queue<T, ForEachArg, N, Allocator>::slot(inPos_mp)) T(std::move(val));
+    circular_queue<T, ForEachArg, N, Allocator>::record_push(1, circular_queue<T, ForEachArg, N, Allocator>::advance(inPos_mp, 1));
+
+    std::atomic_thread_fence(std::memory_order_release);
+    publish();
     return true;
 }
 
 #if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
-template< typename T, typename ForEachArg >
-size_t circular_queue_mp<T, ForEachArg>::push_n(const T* buffer, size_t size)
+template< typename T, typename ForEachArg, size_t N, class Allocator, class Backoff >
+size_t circular_queue_mp<T, ForEachArg, N, Allocator, Backoff>::push_n(const T* buffer, size_t size)
 {
-    const auto outPos = circular_queue<T, ForEachArg>::m_outPos.load(std::memory_order_relaxed);
     size_t inPos_mp;
-    size_t next;
-    size_t blockSize;
-#if !defined(ESP32) && defined(ARDUINO)
+    const auto blockSize = claim(size, inPos_mp);
+    circular_queue<T, ForEachArg, N, Allocator>::record_reject(size - blockSize);
+    if (!blockSize)
     {
-        InterruptLock lock;
-#else
-    ++m_concurrent_mp;
-    do
-    {
-#endif
-        inPos_mp = m_inPos_mp.load(std::memory_order_relaxed);
-        blockSize = (outPos > inPos_mp) ? outPos - 1 - inPos_mp : (outPos == 0) ? circular_queue<T, ForEachArg>::m_bufSize - 1 - inPos_mp : circular_queue<T, ForEachArg>::m_bufSize - inPos_mp;
-        blockSize = min(size, blockSize);
-        if (!blockSize)
-        {
-#if !defined(ESP32) && defined(ARDUINO)
-            return 0;
-        }
-        next = (inPos_mp + blockSize) % circular_queue<T, ForEachArg>::m_bufSize;
-        m_inPos_mp.store(next, std::memory_order_relaxed);
-        m_concurrent_mp.store(m_concurrent_mp.load(std::memory_order_relaxed) + 1,
-            std::memory_order_relaxed);
-        std::atomic_thread_fence(std::memory_order_release);
+        contended(contention_rejection);
+        return 0;
     }
-#else
-            int concurrent_mp = m_concurrent_mp.load();
-            do
-            {
-                inPos_mp = m_inPos_mp.load();
-                concurrent_mp = m_concurrent_mp.load();
-                if (1 == concurrent_mp)
-                {
-                    circular_queue<T, ForEachArg>::m_inPos.store(inPos_mp, std::memory_order_release);
-                }
-            }
-            while (!m_concurrent_mp.compare_exchange_weak(concurrent_mp, concurrent_mp - 1));
-            return false;
-        }
-        next = (inPos_mp + blockSize) % circular_queue<T, ForEachArg>::m_bufSize;
-    }
-    while (!m_inPos_mp.compare_exchange_weak(inPos_mp, next));
-#endif
+    circular_queue<T, ForEachArg, N, Allocator>::record_push(blockSize, circular_queue<T, ForEachArg, N, Allocator>::advance(inPos_mp, blockSize));
 
-    auto dest = circular_queue<T, ForEachArg>::m_buffer.get() + inPos_mp;
-    std::copy_n(std::make_move_iterator(buffer), blockSize, dest);
-    size = min(size - blockSize, outPos > 1 ? static_cast<size_t>(outPos - next - 1) : 0);
-    next += size;
-    dest = circular_queue<T, ForEachArg>::m_buffer.get();
-    std::copy_n(std::make_move_iterator(buffer + blockSize), size, dest);
+    const auto pos = circular_queue<T, ForEachArg, N, Allocator>::slot(inPos_mp);
+    size = min(blockSize, static_cast<size_t>(circular_queue<T, ForEachArg, N, Allocator>::m_buffer.size() - pos));
+    detail::uninitialized_copy_n(buffer, size, circular_queue<T, ForEachArg, N, Allocator>::m_buffer.get() + pos);
+    detail::uninitialized_copy_n(buffer + size, blockSize - size, circular_queue<T, ForEachArg, N, Allocator>::m_buffer.get());
 
     std::atomic_thread_fence(std::memory_order_release);
-
-#if !defined(ESP32) && defined(ARDUINO)
-    {
-        InterruptLock lock;
-        if (1 == m_concurrent_mp.load(std::memory_order_relaxed))
-        {
-            inPos_mp = m_inPos_mp.load(std::memory_order_relaxed);
-            circular_queue<T, ForEachArg>::m_inPos.store(inPos_mp, std::memory_order_relaxed);
-        }
-        m_concurrent_mp.store(m_concurrent_mp.load(std::memory_order_relaxed) - 1,
-            std::memory_order_relaxed);
-        std::atomic_thread_fence(std::memory_order_release);
-    }
-#else
-    int concurrent_mp;
-    do
-    {
-        inPos_mp = m_inPos_mp.load();
-        concurrent_mp = m_concurrent_mp.load();
-        if (1 == concurrent_mp)
-        {
-            circular_queue<T, ForEachArg>::m_inPos.store(inPos_mp, std::memory_order_release);
-        }
-    }
-    while (!m_concurrent_mp.compare_exchange_weak(concurrent_mp, concurrent_mp - 1));
-#endif
-
-    return blockSize + size;
+    publish();
+    return blockSize;
 }
-
 #endif
 
 #endif // __circular_queue_mp_h
@@ -0,0 +1,164 @@
+#pragma once
+/*
+circular_queue_mpmc.h - Implementation of a lock-free multi-producer, multi-consumer queue with sequenced slots.
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __circular_queue_mpmc_h
+#define __circular_queue_mpmc_h
+
+#include "circular_queue_mpsc.h"
+
+#if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
+
+/*!
+    @brief  Instance class for a multi-producer, multi-consumer circular queue / ring buffer (FIFO),
+            with the sequenced slots and the producer side of circular_queue_mpsc.
+            Consumers claim one or a batch of consecutive published elements at a time,
+            each element is popped by exactly one consumer.
+            The capacity is rounded up to a power of two, of at least 2.
+            This implementation is lock-free between all producers and consumers.
+            Consumers, like producers, that lose a race retry after the Backoff policy, see backoff.h.
+            This is not a drop-in replacement for circular_queue_mp. Its template parameters
+            have no fixed capacity N and no Allocator, the ring buffer is always on the heap,
+            and its capacity is rounded up where circular_queue_mp keeps the requested one.
+            Its slots carry a sequence number each, instead of sharing the queue indices,
+            so there is no peek(), pushpeek(), reserve/commit access, find(), or resizing.
+            And pop() and try_pop() find no element while the next one in the queue is still
+            being written, even if later ones are already published.
+*/
+template< typename T, typename ForEachArg = void, class Backoff = ghostl::default_backoff >
+class circular_queue_mpmc : protected circular_queue_mpsc<T, ForEachArg, Backoff>
+{
+public:
+    /*!
+        @brief  Create a queue of at least the given capacity, rounded up to a power of two,
+                and at least 2.
+    */
+    explicit circular_queue_mpmc(const size_t capacity) : circular_queue_mpsc<T, ForEachArg, Backoff>(capacity)
+    {
+    }
+
+    using circular_queue_mpsc<T, ForEachArg, Backoff>::capacity;
+    using circular_queue_mpsc<T, ForEachArg, Backoff>::available;
+    using circular_queue_mpsc<T, ForEachArg, Backoff>::available_for_push;
+    using circular_queue_mpsc<T, ForEachArg, Backoff>::push;
+    using circular_queue_mpsc<T, ForEachArg, Backoff>::push_n;
+
+    /*!
+        @brief  Discard all data in the queue.
+    */
+    void flush()
+    {
+        while (consume(~static_cast<size_t>(0), [](T&) {})) {}
+    }
+
+    /*!
+        @brief  Pop the next available element from the queue, guarded
+                for multiple concurrent consumers.
+        @return true if val received the popped element, false if the queue was empty,
+                or the next element is not yet written.
+    */
+    bool try_pop(T& val)
+    {
+        return consume(1, [&val](T& element) { val = std::move(element); }) != 0;
+    }
+
+    /*!
+        @brief  Pop the next available element from the queue, guarded
+                for multiple concurrent consumers.
+        @return An rvalue copy of the popped element, or a default
+                value of type T if the queue is empty, or the next
+                element is not yet written.
+    */
+    T pop()
+    {
+        T val{};
+        try_pop(val);
+        return val;
+    }
+
+    /*!
+        @brief  Pop multiple elements in ordered sequence from the queue to a buffer,
+                claimed as one batch, guarded for multiple concurrent consumers.
+                If buffer is nullptr, simply discards up to size elements from the queue.
+        @return The number of elements actually popped from the queue to
+                buffer.
+    */
+    size_t pop_n(T* buffer, size_t size)
+    {
+        if (!buffer) return consume(size, [](T&) {});
+        return consume(size, [&buffer](T& element) { *buffer++ = std::move(element); });
+    }
+
+    /*!
+        @brief  Claim up to max consecutive published elements from the queue in one batch,
+                guarded for multiple concurrent consumers, and remove them, calling back
+                visitor with a reference to every single element in place.
+        @return The number of elements that were consumed.
+    */
+    template< typename Visitor >
+    size_t consume(const size_t max, Visitor visitor);
+
+    /*!
+        @brief  Iterate over and remove each available element from queue,
+                calling back fun with an rvalue reference of every single element.
+                Other consumers may pop elements in between.
+    */
+    void for_each(const Delegate<void(T&&), ForEachArg>& fun)
+    {
+        while (consume(~static_cast<size_t>(0), [&fun](T& element) { fun(std::move(element)); })) {}
+    }
+
+protected:
+    using typename circular_queue_mpsc<T, ForEachArg, Backoff>::slot_type;
+};
+
+template< typename T, typename ForEachArg, class Backoff >
+template< typename Visitor >
+size_t circular_queue_mpmc<T, ForEachArg, Backoff>::consume(const size_t max, Visitor visitor)
+{
+    auto pos = circular_queue_mpsc<T, ForEachArg, Backoff>::m_outPos.load(std::memory_order_relaxed);
+    size_t n;
+    for (Backoff backoff;; backoff())
+    {
+        n = 0;
+        while (n < max && circular_queue_mpsc<T, ForEachArg, Backoff>::m_slots[(pos + n) & circular_queue_mpsc<T, ForEachArg, Backoff>::m_mask].
+            sequence.load(std::memory_order_acquire) == pos + n + 1) ++n;
+        if (!n)
+        {
+            // Either the queue is empty, or another consumer has taken the element at pos.
+            const auto outPos = circular_queue_mpsc<T, ForEachArg, Backoff>::m_outPos.load(std::memory_order_relaxed);
+            if (outPos == pos) return 0;
+            pos = outPos;
+            continue;
+        }
+        if (circular_queue_mpsc<T, ForEachArg, Backoff>::m_outPos.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) break;
+    }
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        slot_type& s = circular_queue_mpsc<T, ForEachArg, Backoff>::m_slots[(pos + i) & circular_queue_mpsc<T, ForEachArg, Backoff>::m_mask];
+        visitor(*s.get());
+        circular_queue_mpsc<T, ForEachArg, Backoff>::release(pos + i);
+    }
+    return n;
+}
+
+#endif
+
+#endif // __circular_queue_mpmc_h
@@ -0,0 +1,320 @@
+#pragma once
+/*
+circular_queue_mpsc.h - Implementation of a lock-free multi-producer, single-consumer queue with sequenced slots.
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __circular_queue_mpsc_h
+#define __circular_queue_mpsc_h
+
+#include "circular_queue.h"
+#include "backoff.h"
+
+#if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
+
+namespace detail
+{
+    /*!
+        @brief  A slot of a sequenced ring buffer. Its sequence number tells the queue index
+                for which the slot is free to push, if it equals that index, or holds
+                the element pushed at that index, if it is one past it.
+    */
+    template< typename T >
+    struct circular_queue_sequenced_slot
+    {
+        std::atomic<size_t> sequence;
+        T* get() { return reinterpret_cast<T*>(m_storage); }
+    private:
+        alignas(T) unsigned char m_storage[sizeof(T)];
+    };
+}
+
+/*!
+    @brief  Instance class for a multi-producer, single-consumer circular queue / ring buffer (FIFO),
+            in which each slot carries a sequence number. Unlike circular_queue_mp, where the
+            consumer sees no element until all concurrent producers have completed, each element
+            becomes visible to the consumer as soon as its own producer has written it.
+            A producer that is preempted while writing only holds up the elements after its own.
+            The capacity is rounded up to a power of two, of at least 2.
+            This implementation is lock-free between producers and consumer.
+            Producers that lose a race for a slot retry after the Backoff policy, see backoff.h.
+*/
+template< typename T, typename ForEachArg = void, class Backoff = ghostl::default_backoff >
+class circular_queue_mpsc
+{
+public:
+    /*!
+        @brief  Create a queue of at least the given capacity, rounded up to a power of two,
+                and at least 2.
+    */
+    explicit circular_queue_mpsc(const size_t capacity) :
+        m_mask(pow2(capacity) - 1), m_slots(new slot_type[m_mask + 1])
+    {
+        for (size_t i = 0; i <= m_mask; ++i) m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        m_inPos.store(0);
+        m_outPos.store(0);
+    }
+    circular_queue_mpsc(const circular_queue_mpsc&) = delete;
+    circular_queue_mpsc& operator=(const circular_queue_mpsc&) = delete;
+    ~circular_queue_mpsc()
+    {
+        flush();
+    }
+
+    /*!
+        @brief  Get the number of elements the queue can hold at most.
+    */
+    size_t capacity() const
+    {
+        return m_mask + 1;
+    }
+
+    /*!
+        @brief  Discard all data in the queue.
+    */
+    void flush()
+    {
+        consume(~static_cast<size_t>(0), [](T&) {});
+    }
+
+    /*!
+        @brief  Get a snapshot number of elements in the queue. This includes elements
+                that producers have claimed, but not yet written, which pop does not
+                retrieve yet. The consumer frees the slots of a batch before it advances
+                its index, producers that claim these meanwhile count as in excess of
+                the capacity, which is clamped.
+    */
+    size_t available() const
+    {
+        const auto outPos = m_outPos.load();
+        return min(m_inPos.load() - outPos, capacity());
+    }
+
+    /*!
+        @brief  Get the remaining free elements for pushing.
+    */
+    size_t available_for_push() const
+    {
+        return capacity() - available();
+    }
+
+    /*!
+        @brief  Move the rvalue parameter into the queue, guarded
+                for multiple concurrent producers.
+        @return true if the queue accepted the value, false if the queue
+                was full.
+    */
+    bool push(T&& val);
+
+    /*!
+        @brief  Push a copy of the parameter into the queue, guarded
+                for multiple concurrent producers.
+        @return true if the queue accepted the value, false if the queue
+                was full.
+    */
+    inline bool push(const T& val) ALWAYS_INLINE_ATTR
+    {
+        T v(val);
+        return push(std::move(v));
+    }
+
+    /*!
+        @brief  Push copies of multiple elements from a buffer into the queue,
+                in order, beginning at buffer's head. This is safe for
+                multiple producers. Stops short at the first slot that a consumer
+                has not yet freed.
+        @return The number of elements actually copied into the queue, counted
+                from the buffer head.
+    */
+    size_t push_n(const T* buffer, size_t size);
+
+    /*!
+        @brief  Peek at the next element pop will return without removing it from the queue.
+        @return An rvalue copy of the next element that can be popped. If there is none,
+                return a default value of type T.
+    */
+    T peek()
+    {
+        const auto outPos = m_outPos.load(std::memory_order_relaxed);
+        slot_type& s = m_slots[outPos & m_mask];
+        if (s.sequence.load(std::memory_order_acquire) != outPos + 1) return {};
+        return *s.get();
+    }
+
+    /*!
+        @brief  Pop the next available element from the queue.
+        @return An rvalue copy of the popped element, or a default
+                value of type T if the queue is empty, or the next
+                element is not yet written.
+    */
+    T pop()
+    {
+        T val{};
+        consume(1, [&val](T& element) { val = std::move(element); });
+        return val;
+    }
+
+    /*!
+        @brief  Pop multiple elements in ordered sequence from the queue to a buffer.
+                If buffer is nullptr, simply discards up to size elements from the queue.
+        @return The number of elements actually popped from the queue to
+                buffer.
+    */
+    size_t pop_n(T* buffer, size_t size)
+    {
+        if (!buffer) return consume(size, [](T&) {});
+        return consume(size, [&buffer](T& element) { *buffer++ = std::move(element); });
+    }
+
+    /*!
+        @brief  Remove up to max available elements from the queue in one batch,
+                calling back visitor with a reference to every single element
+                in place. Stops early at an element that is not yet written.
+        @return The number of elements that were consumed.
+    */
+    template< typename Visitor >
+    size_t consume(const size_t max, Visitor visitor);
+
+    /*!
+        @brief  Iterate over and remove each available element from queue,
+                calling back fun with an rvalue reference of every single element.
+    */
+    void for_each(const Delegate<void(T&&), ForEachArg>& fun)
+    {
+        consume(~static_cast<size_t>(0), [&fun](T& element) { fun(std::move(element)); });
+    }
+
+protected:
+    using slot_type = detail::circular_queue_sequenced_slot<T>;
+
+    static size_t pow2(const size_t capacity)
+    {
+        // With a single slot, the sequence number of a published element would
+        // equal that of the slot being free for the next index.
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        return size;
+    }
+
+    /*!
+        @brief  Claim the queue index of a single free slot for the calling producer.
+        @return true if pos received the claimed index, false if the queue was full.
+    */
+    bool claim(size_t& pos)
+    {
+        pos = m_inPos.load(std::memory_order_relaxed);
+        for (Backoff backoff;; backoff())
+        {
+            const auto sequence = m_slots[pos & m_mask].sequence.load(std::memory_order_acquire);
+            const auto lag = static_cast<ptrdiff_t>(sequence - pos);
+            if (!lag)
+            {
+                if (m_inPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) return true;
+            }
+            // The slot still holds the element pushed one round before.
+            else if (lag < 0) return false;
+            else pos = m_inPos.load(std::memory_order_relaxed);
+        }
+    }
+
+    /*!
+        @brief  Make the element written into the slot at queue index pos visible for popping.
+    */
+    void publish(const size_t pos)
+    {
+        m_slots[pos & m_mask].sequence.store(pos + 1, std::memory_order_release);
+    }
+
+    /*!
+        @brief  Destroy the popped element in the slot at queue index pos,
+                and free the slot for pushing it one round later.
+    */
+    void release(const size_t pos)
+    {
+        slot_type& s = m_slots[pos & m_mask];
+        s.get()->~T();
+        s.sequence.store(pos + m_mask + 1, std::memory_order_release);
+    }
+
+    const size_t m_mask;
+    std::unique_ptr<slot_type[]> m_slots;
+    // Claimed by the producers.
+    alignas(GHOSTL_CACHELINE_SIZE) std::atomic<size_t> m_inPos;
+    // Advanced by the consumer.
+    alignas(GHOSTL_CACHELINE_SIZE) std::atomic<size_t> m_outPos;
+};
+
+template< typename T, typename ForEachArg, class Backoff >
+bool circular_queue_mpsc<T, ForEachArg, Backoff>::push(T&& val)
+{
+    size_t pos;
+    if (!claim(pos)) return false;
+    new (m_slots[pos & m_mask].get()) T(std::move(val));
+    publish(pos);
+    return true;
+}
+
+template< typename T, typename ForEachArg, class Backoff >
+size_t circular_queue_mpsc<T, ForEachArg, Backoff>::push_n(const T* buffer, size_t size)
+{
+    size_t pos;
+    size_t blockSize;
+    for (Backoff backoff;; backoff())
+    {
+        pos = m_inPos.load(std::memory_order_relaxed);
+        // Multiple consumers free their slots out of order, so the block ends
+        // at the first slot that is not yet free.
+        blockSize = 0;
+        while (blockSize < size &&
+            m_slots[(pos + blockSize) & m_mask].sequence.load(std::memory_order_acquire) == pos + blockSize) ++blockSize;
+        if (!blockSize)
+        {
+            // The slot still holds the element pushed one round before.
+            if (static_cast<ptrdiff_t>(m_slots[pos & m_mask].sequence.load(std::memory_order_acquire) - pos) < 0) return 0;
+            continue;
+        }
+        if (m_inPos.compare_exchange_weak(pos, pos + blockSize, std::memory_order_relaxed)) break;
+    }
+
+    for (size_t i = 0; i < blockSize; ++i)
+    {
+        new (m_slots[(pos + i) & m_mask].get()) T(buffer[i]);
+        publish(pos + i);
+    }
+    return blockSize;
+}
+
+template< typename T, typename ForEachArg, class Backoff >
+template< typename Visitor >
+size_t circular_queue_mpsc<T, ForEachArg, Backoff>::consume(const size_t max, Visitor visitor)
+{
+    const auto outPos = m_outPos.load(std::memory_order_relaxed);
+    size_t n = 0;
+    for (; n < max; ++n)
+    {
+        slot_type& s = m_slots[(outPos + n) & m_mask];
+        if (s.sequence.load(std::memory_order_acquire) != outPos + n + 1) break;
+        visitor(*s.get());
+        release(outPos + n);
+    }
+    if (n) m_outPos.store(outPos + n, std::memory_order_release);
+    return n;
+}
+
+#endif
+
+#endif // __circular_queue_mpsc_h
@@ -0,0 +1,163 @@
+#pragma once
+/*
+circular_queue_segmented.h - Implementation of an unbounded lock-free queue of circular_queue segments.
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __circular_queue_segmented_h
+#define __circular_queue_segmented_h
+
+#include "circular_queue.h"
+
+#if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
+
+/*!
+    @brief  Instance class for an unbounded single-producer, single-consumer queue (FIFO),
+            made of a linked list of fixed-capacity circular_queue segments of S elements each.
+            When the producer fills its segment, it links another one, taken from a cache of
+            drained segments or newly allocated. The consumer hops to the next segment
+            once it has drained the current one, and returns that to the cache, of up to
+            C segments, or frees it.
+            This implementation is lock-free between producer and consumer, the queue
+            grows with bursts without ever stopping the producer.
+*/
+template< typename T, size_t S = 64, size_t C = 2 >
+class circular_queue_segmented
+{
+public:
+    circular_queue_segmented()
+    {
+        m_tail = new segment();
+        m_head = m_tail;
+    }
+    circular_queue_segmented(const circular_queue_segmented&) = delete;
+    circular_queue_segmented& operator=(const circular_queue_segmented&) = delete;
+    ~circular_queue_segmented()
+    {
+        while (m_head)
+        {
+            segment* const next = m_head->next.load();
+            delete m_head;
+            m_head = next;
+        }
+        while (m_cache.available()) delete m_cache.pop();
+    }
+
+    /*!
+        @brief  Get a snapshot number of elements that can be retrieved by pop.
+                This walks all segments and is meant for the consumer.
+    */
+    size_t available() const
+    {
+        size_t count = 0;
+        for (const segment* seg = m_head; seg; seg = seg->next.load(std::memory_order_acquire))
+        {
+            count += seg->queue.available();
+        }
+        return count;
+    }
+
+    /*!
+        @brief  Move the rvalue parameter into the queue.
+        @return true if the queue accepted the value, false if a new segment
+                was needed and could not be allocated.
+    */
+    bool push(T&& val);
+
+    /*!
+        @brief  Push a copy of the parameter into the queue.
+        @return true if the queue accepted the value, false if a new segment
+                was needed and could not be allocated.
+    */
+    inline bool push(const T& val) ALWAYS_INLINE_ATTR
+    {
+        T v(val);
+        return push(std::move(v));
+    }
+
+    /*!
+        @brief  Pop the next available element from the queue.
+        @return An rvalue copy of the popped element, or a default
+                value of type T if the queue is empty.
+    */
+    T pop();
+
+protected:
+    struct segment
+    {
+        segment()
+        {
+            next.store(nullptr, std::memory_order_relaxed);
+        }
+        circular_queue<T, void, S> queue;
+        std::atomic<segment*> next;
+    };
+
+    /*!
+        @brief  Get a drained segment from the cache, or allocate one.
+    */
+    segment* acquire_segment()
+    {
+        if (m_cache.available())
+        {
+            segment* const seg = m_cache.pop();
+            seg->next.store(nullptr, std::memory_order_relaxed);
+            return seg;
+        }
+        return new (std::nothrow) segment();
+    }
+
+    // Drained segments, pushed by the consumer and popped by the producer.
+    circular_queue<segment*, void, C> m_cache;
+    // Owned by the producer.
+    alignas(GHOSTL_CACHELINE_SIZE) segment* m_tail;
+    // Owned by the consumer.
+    alignas(GHOSTL_CACHELINE_SIZE) segment* m_head;
+};
+
+template< typename T, size_t S, size_t C >
+bool circular_queue_segmented<T, S, C>::push(T&& val)
+{
+    if (m_tail->queue.push(std::move(val))) return true;
+    segment* const seg = acquire_segment();
+    if (!seg) return false;
+    seg->queue.push(std::move(val));
+    m_tail->next.store(seg, std::memory_order_release);
+    m_tail = seg;
+    return true;
+}
+
+template< typename T, size_t S, size_t C >
+T circular_queue_segmented<T, S, C>::pop()
+{
+    for (;;)
+    {
+        if (m_head->queue.available()) return m_head->queue.pop();
+        segment* const next = m_head->next.load(std::memory_order_acquire);
+        if (!next) return {};
+        // The producer filled this segment before linking the next one,
+        // check again for elements pushed since the test above.
+        if (m_head->queue.available()) return m_head->queue.pop();
+        segment* const drained = m_head;
+        m_head = next;
+        if (!m_cache.push(drained)) delete drained;
+    }
+}
+
+#endif
+
+#endif // __circular_queue_segmented_h
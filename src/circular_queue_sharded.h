@@ -0,0 +1,359 @@
+#pragma once
+/*
+circular_queue_sharded.h - Implementation of a multi-producer, single-consumer queue of per-producer lanes.
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __circular_queue_sharded_h
+#define __circular_queue_sharded_h
+
+#include "circular_queue.h"
+
+#if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
+
+#include <vector>
+#if !defined(ARDUINO)
+#include <chrono>
+#endif
+
+/*!
+    @brief  Instance class for a multi-producer, single-consumer queue (FIFO per producer),
+            that is sharded into lanes. Each producer thread pushes into its own single-producer,
+            single-consumer circular_queue lane of a fixed capacity, so that producers share
+            no cache lines with each other. A thread registers its lane on its first push, and
+            releases it on exit, for reuse by a later thread.
+            The consumer drains the lanes round-robin. If Ordered is true, every element is
+            time stamped on push, and the consumer pops in the order of the stamps instead,
+            which costs a clock read per push and a scan of all lanes per pop.
+            This ordering is best-effort: an element is stamped before it is published to its
+            lane, so a pop only considers the stamps that are visible at that time, and may
+            return an element that is later than one still being pushed.
+            This implementation is lock-free between producers and consumer.
+*/
+template< typename T, bool Ordered = false >
+class circular_queue_sharded
+{
+public:
+    /*!
+        @brief  Create a queue of up to maxLanes producer lanes, each of the given capacity.
+    */
+    circular_queue_sharded(const size_t laneCapacity, const size_t maxLanes) :
+        m_id(next_id()), m_laneCapacity(laneCapacity), m_maxLanes(maxLanes),
+        m_owners(new std::shared_ptr<lane>[maxLanes]), m_lanes(new std::atomic<lane*>[maxLanes])
+    {
+        for (size_t i = 0; i < maxLanes; ++i) m_lanes[i].store(nullptr, std::memory_order_relaxed);
+        m_laneCount.store(0);
+        m_nextLane = 0;
+    }
+    circular_queue_sharded(const circular_queue_sharded&) = delete;
+    circular_queue_sharded& operator=(const circular_queue_sharded&) = delete;
+    /*!
+        @brief  Destroy the queue. The lanes of producer threads that are still running
+                are freed when these exit.
+    */
+    ~circular_queue_sharded()
+    {
+        const size_t count = m_laneCount.load();
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (m_owners[i]) m_owners[i]->retired.store(true);
+        }
+    }
+
+    /*!
+        @brief  Get the number of elements each producer lane can hold at most.
+    */
+    size_t lane_capacity() const
+    {
+        return m_laneCapacity;
+    }
+
+    /*!
+        @brief  Get the number of lanes that producers have registered so far.
+    */
+    size_t lanes() const
+    {
+        return m_laneCount.load();
+    }
+
+    /*!
+        @brief  Get a snapshot number of elements in all lanes that can be retrieved by pop.
+    */
+    size_t available() const
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < lanes(); ++i)
+        {
+            const lane* const l = m_lanes[i].load(std::memory_order_acquire);
+            if (l) count += l->queue.available();
+        }
+        return count;
+    }
+
+    /*!
+        @brief  Move the rvalue parameter into the calling thread's lane.
+        @return true if the queue accepted the value, false if the lane was full,
+                or no lane was left for a newly pushing thread.
+    */
+    bool push(T&& val)
+    {
+        lane* const l = local_lane();
+        return l && l->queue.push(make_element(std::move(val), std::integral_constant<bool, Ordered>()));
+    }
+
+    /*!
+        @brief  Push a copy of the parameter into the calling thread's lane.
+        @return true if the queue accepted the value, false if the lane was full,
+                or no lane was left for a newly pushing thread.
+    */
+    inline bool push(const T& val) ALWAYS_INLINE_ATTR
+    {
+        T v(val);
+        return push(std::move(v));
+    }
+
+    /*!
+        @brief  Pop the next available element, from the lanes in turn, or the element
+                with the earliest visible time stamp if Ordered is true.
+        @return An rvalue copy of the popped element, or a default
+                value of type T if all lanes are empty.
+    */
+    T pop()
+    {
+        T val{};
+        consume(1, [&val](T&& element) { val = std::move(element); });
+        return val;
+    }
+
+    /*!
+        @brief  Pop multiple elements from the lanes to a buffer, see pop().
+                If buffer is nullptr, simply discards up to size elements from the queue.
+        @return The number of elements actually popped from the queue to
+                buffer.
+    */
+    size_t pop_n(T* buffer, size_t size)
+    {
+        if (!buffer) return consume(size, [](T&&) {});
+        return consume(size, [&buffer](T&& element) { *buffer++ = std::move(element); });
+    }
+
+    /*!
+        @brief  Remove up to max available elements from the lanes, calling back visitor
+                with an rvalue reference to every single element.
+                Without Ordered, each lane in turn is drained in one batch.
+        @return The number of elements that were consumed.
+    */
+    template< typename Visitor >
+    size_t consume(const size_t max, Visitor visitor)
+    {
+        return consume(max, visitor, std::integral_constant<bool, Ordered>());
+    }
+
+protected:
+    struct stamped
+    {
+        T item;
+        uint64_t stamp;
+    };
+    using element_type = typename std::conditional<Ordered, stamped, T>::type;
+
+    struct lane
+    {
+        explicit lane(const size_t capacity) : queue(capacity)
+        {
+            owned.store(true, std::memory_order_relaxed);
+            retired.store(false, std::memory_order_relaxed);
+        }
+        circular_queue<element_type> queue;
+        // Whether a running producer thread pushes into the lane.
+        std::atomic<bool> owned;
+        // Whether the queue of the lane was destroyed.
+        std::atomic<bool> retired;
+    };
+
+    /*!
+        @brief  The lanes of one thread, by the ids of their queues. Releases them on thread exit.
+    */
+    struct registry
+    {
+        ~registry()
+        {
+            for (auto& entry : entries) entry.second->owned.store(false, std::memory_order_release);
+        }
+        std::vector<std::pair<uint64_t, std::shared_ptr<lane>>> entries;
+        uint64_t lastId = 0;
+        lane* last = nullptr;
+    };
+
+    static registry& local()
+    {
+        static thread_local registry r;
+        return r;
+    }
+
+    static uint64_t next_id()
+    {
+        static std::atomic<uint64_t> id{ 0 };
+        return ++id;
+    }
+
+    static uint64_t now()
+    {
+#if defined(ARDUINO)
+        return micros();
+#else
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+    }
+
+    static element_type make_element(T&& val, std::false_type)
+    {
+        return std::move(val);
+    }
+    static element_type make_element(T&& val, std::true_type)
+    {
+        return { std::move(val), now() };
+    }
+    static T&& item(T& element)
+    {
+        return std::move(element);
+    }
+    static T&& item(stamped& element)
+    {
+        return std::move(element.item);
+    }
+
+    /*!
+        @brief  Get the lane of the calling thread, registering one on its first push.
+    */
+    lane* local_lane()
+    {
+        registry& r = local();
+        if (r.lastId == m_id) return r.last;
+        lane* l = nullptr;
+        for (auto entry = r.entries.begin(); entry != r.entries.end();)
+        {
+            if (entry->first == m_id) l = entry->second.get();
+            // The lanes of destroyed queues.
+            if (entry->second->retired.load(std::memory_order_relaxed)) entry = r.entries.erase(entry);
+            else ++entry;
+        }
+        if (!l) l = register_lane(r);
+        if (l)
+        {
+            r.lastId = m_id;
+            r.last = l;
+        }
+        return l;
+    }
+
+    lane* register_lane(registry& r);
+
+    template< typename Visitor >
+    size_t consume(size_t max, Visitor& visitor, std::false_type);
+    // Pops the element with the earliest stamp among the lane heads published so far,
+    // one at a time, rescanning the lanes for each.
+    template< typename Visitor >
+    size_t consume(size_t max, Visitor& visitor, std::true_type);
+
+    const uint64_t m_id;
+    const size_t m_laneCapacity;
+    const size_t m_maxLanes;
+    // Written once per lane index, by the registering producer.
+    std::unique_ptr<std::shared_ptr<lane>[]> m_owners;
+    std::unique_ptr<std::atomic<lane*>[]> m_lanes;
+    std::atomic<size_t> m_laneCount;
+    // Owned by the consumer.
+    alignas(GHOSTL_CACHELINE_SIZE) size_t m_nextLane;
+};
+
+template< typename T, bool Ordered >
+typename circular_queue_sharded<T, Ordered>::lane* circular_queue_sharded<T, Ordered>::register_lane(registry& r)
+{
+    // Take over a lane that a terminated thread has released, it may still hold elements.
+    for (size_t i = 0; i < lanes(); ++i)
+    {
+        lane* const l = m_lanes[i].load(std::memory_order_acquire);
+        bool owned = false;
+        if (l && l->owned.compare_exchange_strong(owned, true, std::memory_order_acquire))
+        {
+            r.entries.emplace_back(m_id, m_owners[i]);
+            return l;
+        }
+    }
+    // Allocate the lane before claiming its index, so that a failed allocation
+    // leaves no index behind without a lane.
+    std::shared_ptr<lane> l(new (std::nothrow) lane(m_laneCapacity));
+    if (!l) return nullptr;
+    size_t i = m_laneCount.load();
+    do
+    {
+        if (i >= m_maxLanes) return nullptr;
+    } while (!m_laneCount.compare_exchange_weak(i, i + 1));
+    m_owners[i] = l;
+    r.entries.emplace_back(m_id, l);
+    m_lanes[i].store(l.get(), std::memory_order_release);
+    return l.get();
+}
+
+template< typename T, bool Ordered >
+template< typename Visitor >
+size_t circular_queue_sharded<T, Ordered>::consume(const size_t max, Visitor& visitor, std::false_type)
+{
+    const size_t count = lanes();
+    size_t n = 0;
+    for (size_t turn = 0; turn < count && n < max; ++turn)
+    {
+        const size_t i = m_nextLane < count ? m_nextLane : 0;
+        m_nextLane = i + 1;
+        lane* const l = m_lanes[i].load(std::memory_order_acquire);
+        if (!l) continue;
+        n += l->queue.consume(max - n, [&visitor](element_type& element) { visitor(item(element)); });
+    }
+    return n;
+}
+
+template< typename T, bool Ordered >
+template< typename Visitor >
+size_t circular_queue_sharded<T, Ordered>::consume(const size_t max, Visitor& visitor, std::true_type)
+{
+    size_t n = 0;
+    for (; n < max; ++n)
+    {
+        lane* earliest = nullptr;
+        uint64_t stamp = 0;
+        for (size_t i = 0; i < lanes(); ++i)
+        {
+            lane* const l = m_lanes[i].load(std::memory_order_acquire);
+            if (!l) continue;
+            const auto head = l->queue.reserve_read(1);
+            if (head.first.size && (!earliest || head.first.data->stamp < stamp))
+            {
+                earliest = l;
+                stamp = head.first.data->stamp;
+            }
+        }
+        if (!earliest) break;
+        earliest->queue.consume(1, [&visitor](element_type& element) { visitor(item(element)); });
+    }
+    return n;
+}
+
+#endif
+
+#endif // __circular_queue_sharded_h
@@ -0,0 +1,407 @@
+#pragma once
+/*
+circular_queue_shm.h - Implementation of a lock-free circular queue in shared memory.
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __circular_queue_shm_h
+#define __circular_queue_shm_h
+
+#include "circular_queue_mp.h"
+
+#if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
+#include <cstdint>
+#include <type_traits>
+
+namespace detail
+{
+    /*!
+        @brief  The control block at the start of a circular_queue_shm region. It holds only
+                offsets and indices, no pointers, so each process can map the region at
+                a different address. The fields that describe the layout have fixed widths,
+                so that a process built with a different size_t or element type reads them
+                alike, and is rejected by attach().
+    */
+    struct circular_queue_shm_header
+    {
+        static constexpr uint32_t MAGIC = 0x47435153; // "GCQS"
+        static constexpr uint32_t VERSION = 1;
+
+        std::atomic<uint32_t> magic;
+        uint32_t version;
+        uint32_t elementSize;
+        uint32_t indexSize;
+        uint64_t bufferSize;
+        uint64_t slotsOffset;
+        alignas(GHOSTL_CACHELINE_SIZE) std::atomic<size_t> inPos;
+        alignas(GHOSTL_CACHELINE_SIZE) std::atomic<size_t> outPos;
+        alignas(GHOSTL_CACHELINE_SIZE) std::atomic<size_t> inPos_mp;
+        std::atomic<int> concurrent_mp;
+    };
+}
+
+/*!
+    @brief  Instance class for a single-producer, single-consumer circular queue / ring buffer (FIFO)
+            whose indices and slots live in a caller-provided memory region, for instance a POSIX
+            shm_open() or memfd_create() mapping. One process creates the queue in the region,
+            others attach to it, and producer and consumer may then be in different processes.
+            This implementation is lock-free between producer and consumer and makes no system calls.
+            T must be trivially copyable, as its bytes cross the process boundary unchanged.
+*/
+template< typename T >
+class circular_queue_shm
+{
+    static_assert(std::is_trivially_copyable<T>::value, "circular_queue_shm requires a trivially copyable T");
+#if __cplusplus >= 201703L
+    static_assert(std::atomic<size_t>::is_always_lock_free && std::atomic<int>::is_always_lock_free,
+        "circular_queue_shm requires address-free lock-free atomics");
+#endif
+
+public:
+    circular_queue_shm() : m_header(nullptr), m_slots(nullptr), m_bufferSize(0), m_outPosCache(0), m_inPosCache(0)
+    {
+    }
+    circular_queue_shm(const circular_queue_shm&) = delete;
+    circular_queue_shm& operator=(const circular_queue_shm&) = delete;
+
+    /*!
+        @brief  Get the size of a region for a queue of the given capacity.
+    */
+    static size_t region_size(const size_t capacity)
+    {
+        return slots_offset() + sizeof(T) * (capacity + 1);
+    }
+
+    /*!
+        @brief  Initialize an empty queue in the region, with the largest capacity that fits.
+                Any previous queue in the region is lost. The region must be aligned for T
+                and the control block, as a page-aligned mapping is.
+        @return true if the queue was created, false if the region is misaligned or too small.
+    */
+    bool create(void* region, const size_t regionSize);
+
+    /*!
+        @brief  Attach to a queue that another process has created in the region.
+        @return true if the region holds a queue of this layout version, element size and
+                index size that fits its size, otherwise the instance is left detached and
+                false is returned.
+    */
+    bool attach(void* region, const size_t regionSize);
+
+    /*!
+        @brief  Detach from the region. The queue in the region is unaffected.
+    */
+    void detach()
+    {
+        m_header = nullptr;
+        m_slots = nullptr;
+    }
+
+    /*!
+        @brief  Test whether the instance is created in, or attached to, a region.
+    */
+    bool attached() const
+    {
+        return m_header != nullptr;
+    }
+
+    /*!
+        @brief  Get the number of elements the queue can hold at most.
+    */
+    size_t capacity() const
+    {
+        return m_bufferSize - 1;
+    }
+
+    /*!
+        @brief  Discard all data in the queue.
+    */
+    void flush()
+    {
+        m_inPosCache = m_header->inPos.load(std::memory_order_acquire);
+        m_header->outPos.store(m_inPosCache, std::memory_order_release);
+    }
+
+    /*!
+        @brief  Get a snapshot number of elements that can be retrieved by pop.
+    */
+    size_t available() const
+    {
+        return distance(m_header->outPos.load(std::memory_order_relaxed),
+            m_header->inPos.load(std::memory_order_acquire));
+    }
+
+    /*!
+        @brief  Get the remaining free elements for pushing.
+    */
+    size_t available_for_push() const
+    {
+        return capacity() - distance(m_header->outPos.load(std::memory_order_acquire),
+            m_header->inPos.load(std::memory_order_relaxed));
+    }
+
+    /*!
+        @brief  Peek at the next element pop will return without removing it from the queue.
+        @return A copy of the next element that can be popped. If the queue is empty,
+                return a default value of type T.
+    */
+    T peek() const
+    {
+        const auto outPos = m_header->outPos.load(std::memory_order_relaxed);
+        if (m_header->inPos.load(std::memory_order_acquire) == outPos) return {};
+        return m_slots[outPos];
+    }
+
+    /*!
+        @brief  Push a copy of the parameter into the queue.
+        @return true if the queue accepted the value, false if the queue
+                was full.
+    */
+    bool push(const T& val);
+
+    /*!
+        @brief  Push copies of multiple elements from a buffer into the queue,
+                in order, beginning at buffer's head.
+        @return The number of elements actually copied into the queue, counted
+                from the buffer head.
+    */
+    size_t push_n(const T* buffer, size_t size);
+
+    /*!
+        @brief  Pop the next available element from the queue.
+        @return A copy of the element, or a default value of type T if the queue is empty.
+    */
+    T pop();
+
+    /*!
+        @brief  Pop multiple elements in ordered sequence from the queue to a buffer.
+                If buffer is nullptr, simply discards up to size elements from the queue.
+        @return The number of elements actually popped from the queue to
+                buffer.
+    */
+    size_t pop_n(T* buffer, size_t size);
+
+protected:
+    static constexpr size_t slots_offset()
+    {
+        return (sizeof(detail::circular_queue_shm_header) + alignof(T) - 1) / alignof(T) * alignof(T);
+    }
+
+    inline size_t advance(const size_t pos, const size_t n) const ALWAYS_INLINE_ATTR
+    {
+        const size_t next = pos + n;
+        return next >= m_bufferSize ? next - m_bufferSize : next;
+    }
+
+    inline size_t distance(const size_t from, const size_t to) const ALWAYS_INLINE_ATTR
+    {
+        return to >= from ? to - from : to + m_bufferSize - from;
+    }
+
+    /*!
+        @brief  Copy size elements from buffer into the slots, starting at queue index pos.
+    */
+    void copy_in(const size_t pos, const T* buffer, const size_t size)
+    {
+        const size_t n = min(size, m_bufferSize - pos);
+        std::copy_n(buffer, n, m_slots + pos);
+        std::copy_n(buffer + n, size - n, m_slots);
+    }
+
+    // Process-local pointers into the shared region.
+    detail::circular_queue_shm_header* m_header;
+    T* m_slots;
+    // Process-local copy of the immutable ring buffer size.
+    size_t m_bufferSize;
+    // Process-local caches of the other side's index.
+    alignas(GHOSTL_CACHELINE_SIZE) size_t m_outPosCache;
+    alignas(GHOSTL_CACHELINE_SIZE) size_t m_inPosCache;
+};
+
+template< typename T >
+bool circular_queue_shm<T>::create(void* region, const size_t regionSize)
+{
+    detach();
+    if (!region || reinterpret_cast<uintptr_t>(region) % alignof(detail::circular_queue_shm_header)) return false;
+    if (regionSize < region_size(1)) return false;
+    auto header = new (region) detail::circular_queue_shm_header();
+    header->version = detail::circular_queue_shm_header::VERSION;
+    header->elementSize = sizeof(T);
+    header->indexSize = sizeof(size_t);
+    header->bufferSize = (regionSize - slots_offset()) / sizeof(T);
+    header->slotsOffset = slots_offset();
+    header->inPos.store(0, std::memory_order_relaxed);
+    header->outPos.store(0, std::memory_order_relaxed);
+    header->inPos_mp.store(0, std::memory_order_relaxed);
+    header->concurrent_mp.store(0, std::memory_order_relaxed);
+    header->magic.store(detail::circular_queue_shm_header::MAGIC, std::memory_order_release);
+    return attach(region, regionSize);
+}
+
+template< typename T >
+bool circular_queue_shm<T>::attach(void* region, const size_t regionSize)
+{
+    detach();
+    if (!region || reinterpret_cast<uintptr_t>(region) % alignof(detail::circular_queue_shm_header)) return false;
+    if (regionSize < sizeof(detail::circular_queue_shm_header)) return false;
+    auto header = static_cast<detail::circular_queue_shm_header*>(region);
+    if (header->magic.load(std::memory_order_acquire) != detail::circular_queue_shm_header::MAGIC ||
+        header->version != detail::circular_queue_shm_header::VERSION ||
+        header->elementSize != sizeof(T) || header->indexSize != sizeof(size_t) || header->slotsOffset != slots_offset() ||
+        header->bufferSize < 2 || header->bufferSize > (regionSize - slots_offset()) / sizeof(T)) return false;
+    m_header = header;
+    m_slots = reinterpret_cast<T*>(static_cast<unsigned char*>(region) + slots_offset());
+    m_bufferSize = static_cast<size_t>(header->bufferSize);
+    m_outPosCache = m_header->outPos.load(std::memory_order_acquire);
+    m_inPosCache = m_header->inPos.load(std::memory_order_acquire);
+    return true;
+}
+
+template< typename T >
+bool circular_queue_shm<T>::push(const T& val)
+{
+    const auto inPos = m_header->inPos.load(std::memory_order_relaxed);
+    if (distance(m_outPosCache, inPos) == capacity()) {
+        m_outPosCache = m_header->outPos.load(std::memory_order_acquire);
+        if (distance(m_outPosCache, inPos) == capacity()) return false;
+    }
+    m_slots[inPos] = val;
+    m_header->inPos.store(advance(inPos, 1), std::memory_order_release);
+    return true;
+}
+
+template< typename T >
+size_t circular_queue_shm<T>::push_n(const T* buffer, size_t size)
+{
+    const auto inPos = m_header->inPos.load(std::memory_order_relaxed);
+    if (capacity() - distance(m_outPosCache, inPos) < size)
+    {
+        m_outPosCache = m_header->outPos.load(std::memory_order_acquire);
+    }
+    size = min(size, capacity() - distance(m_outPosCache, inPos));
+    if (!size) return 0;
+    copy_in(inPos, buffer, size);
+    m_header->inPos.store(advance(inPos, size), std::memory_order_release);
+    return size;
+}
+
+template< typename T >
+T circular_queue_shm<T>::pop()
+{
+    const auto outPos = m_header->outPos.load(std::memory_order_relaxed);
+    if (m_inPosCache == outPos)
+    {
+        m_inPosCache = m_header->inPos.load(std::memory_order_acquire);
+        if (m_inPosCache == outPos) return {};
+    }
+    const T val = m_slots[outPos];
+    m_header->outPos.store(advance(outPos, 1), std::memory_order_release);
+    return val;
+}
+
+template< typename T >
+size_t circular_queue_shm<T>::pop_n(T* buffer, size_t size)
+{
+    const auto outPos = m_header->outPos.load(std::memory_order_relaxed);
+    if (distance(outPos, m_inPosCache) < size)
+    {
+        m_inPosCache = m_header->inPos.load(std::memory_order_acquire);
+    }
+    size = min(size, distance(outPos, m_inPosCache));
+    if (!size) return 0;
+    if (buffer)
+    {
+        const size_t n = min(size, m_bufferSize - outPos);
+        buffer = std::copy_n(m_slots + outPos, n, buffer);
+        std::copy_n(m_slots, size - n, buffer);
+    }
+    m_header->outPos.store(advance(outPos, size), std::memory_order_release);
+    return size;
+}
+
+/*!
+    @brief  Instance class for a multi-producer, single-consumer circular queue / ring buffer (FIFO)
+            in a caller-provided memory region, see circular_queue_shm. Producers in several
+            processes claim slots with the protocol of circular_queue_mp, see circular_queue_mp_protocol.
+            Producers that lose a race for the claim retry after the Backoff policy, see backoff.h.
+            A producer that terminates between claiming and publishing its slots stalls
+            all later pushes, so this does not isolate faults among the producers.
+*/
+template< typename T, class Backoff = ghostl::default_backoff >
+class circular_queue_mp_shm : protected circular_queue_shm<T>
+{
+public:
+    using circular_queue_shm<T>::region_size;
+    using circular_queue_shm<T>::create;
+    using circular_queue_shm<T>::attach;
+    using circular_queue_shm<T>::detach;
+    using circular_queue_shm<T>::attached;
+    using circular_queue_shm<T>::capacity;
+    using circular_queue_shm<T>::flush;
+    using circular_queue_shm<T>::available;
+    using circular_queue_shm<T>::available_for_push;
+    using circular_queue_shm<T>::peek;
+    using circular_queue_shm<T>::pop;
+    using circular_queue_shm<T>::pop_n;
+
+    /*!
+        @brief  Push a copy of the parameter into the queue, guarded
+                for multiple concurrent producers.
+        @return true if the queue accepted the value, false if the queue
+                was full.
+    */
+    bool push(const T& val)
+    {
+        return push_n(&val, 1) == 1;
+    }
+
+    /*!
+        @brief  Push copies of multiple elements from a buffer into the queue,
+                in order, beginning at buffer's head. This is safe for
+                multiple producers.
+        @return The number of elements actually copied into the queue, counted
+                from the buffer head.
+    */
+    size_t push_n(const T* buffer, size_t size);
+};
+
+template< typename T, class Backoff >
+size_t circular_queue_mp_shm<T, Backoff>::push_n(const T* buffer, size_t size)
+{
+    using protocol = detail::circular_queue_mp_protocol<Backoff>;
+    auto& header = *circular_queue_shm<T>::m_header;
+    size_t inPos_mp;
+    const auto blockSize = protocol::claim(header.inPos_mp, header.concurrent_mp, inPos_mp,
+        [this, &header, size](const size_t pos, size_t& next) -> size_t
+        {
+            const auto used = circular_queue_shm<T>::distance(header.outPos.load(std::memory_order_acquire), pos);
+            const auto claimed = min(size, capacity() - min(used, capacity()));
+            next = circular_queue_shm<T>::advance(pos, claimed);
+            return claimed;
+        });
+    if (blockSize)
+    {
+        circular_queue_shm<T>::copy_in(inPos_mp, buffer, blockSize);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+    protocol::publish(header.inPos_mp, header.concurrent_mp, header.inPos);
+    return blockSize;
+}
+
+#endif
+
+#endif // __circular_queue_shm_h
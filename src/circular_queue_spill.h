@@ -0,0 +1,260 @@
+#pragma once
+/*
+circular_queue_spill.h - Implementation of a lock-free circular queue that spills to a file when full.
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __circular_queue_spill_h
+#define __circular_queue_spill_h
+
+#include "circular_queue_mp.h"
+
+#if !defined(ARDUINO) && (defined(__unix__) || defined(__APPLE__))
+
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*!
+    @brief  Instance class for a multi-producer, single-consumer circular queue / ring buffer (FIFO)
+            that does not drop elements when it is full, but appends them to a memory-mapped
+            spill file instead. Once an element is spilled, all following pushes are spilled,
+            until the consumer has drained both the ring buffer and the spill file, so elements
+            are delivered in FIFO order for each producer.
+            Pushing into and popping from the ring buffer is lock-free as for circular_queue_mp,
+            accessing the spill file is serialized by a mutex.
+            The spill file grows up to a size limit, beyond which pushes are rejected. When it
+            runs out of room, the unread elements are moved to its start if the consumer has
+            read at least half of it, and the file is truncated once the consumer has drained it.
+            T must be trivially copyable, as it is stored bytewise in the spill file.
+*/
+template< typename T, typename ForEachArg = void, size_t N = 0, class Allocator = detail::circular_queue_allocator<T> >
+class circular_queue_mp_spill : protected circular_queue_mp<T, ForEachArg, N, Allocator>
+{
+    static_assert(std::is_trivially_copyable<T>::value, "circular_queue_mp_spill requires a trivially copyable T");
+
+public:
+    circular_queue_mp_spill() : circular_queue_mp<T, ForEachArg, N, Allocator>()
+    {
+        m_spilling.store(false);
+    }
+    circular_queue_mp_spill(const size_t capacity) : circular_queue_mp<T, ForEachArg, N, Allocator>(capacity)
+    {
+        m_spilling.store(false);
+    }
+    circular_queue_mp_spill(const circular_queue_mp_spill&) = delete;
+    circular_queue_mp_spill& operator=(const circular_queue_mp_spill&) = delete;
+    ~circular_queue_mp_spill()
+    {
+        close();
+    }
+
+    using circular_queue_mp<T, ForEachArg, N, Allocator>::capacity;
+
+    /*!
+        @brief  Create the spill file at path. The file is unlinked right away, it only
+                lives as long as it is open. It grows to at most maxSize bytes, pushes that
+                would not fit are rejected.
+        @return true if the file was created, otherwise spilling remains disabled.
+    */
+    bool open(const char* path, const size_t maxSize = SIZE_MAX);
+
+    /*!
+        @brief  Close the spill file. Spilled elements that were not yet popped are lost.
+    */
+    void close();
+
+    /*!
+        @brief  Get a snapshot number of elements that can be retrieved by pop,
+                including the spilled ones.
+    */
+    size_t available()
+    {
+        std::lock_guard<std::mutex> lock(m_spillMutex);
+        return circular_queue_mp<T, ForEachArg, N, Allocator>::available() + (m_writeOff - m_readOff) / sizeof(T);
+    }
+
+    /*!
+        @brief  Get a snapshot number of elements in the spill file.
+    */
+    size_t spilled()
+    {
+        std::lock_guard<std::mutex> lock(m_spillMutex);
+        return (m_writeOff - m_readOff) / sizeof(T);
+    }
+
+    /*!
+        @brief  Push a copy of the parameter into the queue, guarded for multiple
+                concurrent producers. Spills it if the ring buffer is full, or if
+                earlier elements are spilled.
+        @return true if the queue accepted the value, false if the ring buffer was full
+                and the element could not be spilled.
+    */
+    bool push(const T& val)
+    {
+        if (!m_spilling.load() && circular_queue_mp<T, ForEachArg, N, Allocator>::push(val)) return true;
+        return spill(val);
+    }
+
+    /*!
+        @brief  Pop the next available element from the queue, from the ring buffer,
+                or once that is drained, from the spill file.
+        @return A copy of the popped element, or a default value of type T
+                if the queue is empty.
+    */
+    T pop();
+
+protected:
+    using base = circular_queue_mp<T, ForEachArg, N, Allocator>;
+
+    static constexpr size_t INITIAL_SPILL_SIZE = 1024 * 1024;
+
+    bool spill(const T& val);
+    bool grow();
+    void compact();
+    void release();
+
+    std::mutex m_spillMutex;
+    int m_fd = -1;
+    unsigned char* m_map = nullptr;
+    size_t m_mapSize = 0;
+    size_t m_maxSize = 0;
+    size_t m_writeOff = 0;
+    size_t m_readOff = 0;
+    std::atomic<bool> m_spilling;
+};
+
+template< typename T, typename ForEachArg, size_t N, class Allocator >
+bool circular_queue_mp_spill<T, ForEachArg, N, Allocator>::open(const char* path, const size_t maxSize)
+{
+    close();
+    std::lock_guard<std::mutex> lock(m_spillMutex);
+    m_fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (m_fd < 0) return false;
+    unlink(path);
+    m_maxSize = maxSize;
+    return true;
+}
+
+template< typename T, typename ForEachArg, size_t N, class Allocator >
+void circular_queue_mp_spill<T, ForEachArg, N, Allocator>::close()
+{
+    std::lock_guard<std::mutex> lock(m_spillMutex);
+    if (m_map) munmap(m_map, m_mapSize);
+    if (m_fd >= 0) ::close(m_fd);
+    m_fd = -1;
+    m_map = nullptr;
+    m_mapSize = 0;
+    m_maxSize = 0;
+    m_writeOff = 0;
+    m_readOff = 0;
+    m_spilling.store(false);
+}
+
+template< typename T, typename ForEachArg, size_t N, class Allocator >
+bool circular_queue_mp_spill<T, ForEachArg, N, Allocator>::grow()
+{
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t size = m_mapSize ? 2 * m_mapSize : INITIAL_SPILL_SIZE;
+    size = min((std::max(size, m_writeOff + sizeof(T)) + page - 1) / page * page, m_maxSize);
+    if (size < m_writeOff + sizeof(T)) return false;
+    if (ftruncate(m_fd, static_cast<off_t>(size))) return false;
+    void* const map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (MAP_FAILED == map) return false;
+    if (m_map) munmap(m_map, m_mapSize);
+    m_map = static_cast<unsigned char*>(map);
+    m_mapSize = size;
+    return true;
+}
+
+template< typename T, typename ForEachArg, size_t N, class Allocator >
+void circular_queue_mp_spill<T, ForEachArg, N, Allocator>::compact()
+{
+    memmove(m_map, m_map + m_readOff, m_writeOff - m_readOff);
+    m_writeOff -= m_readOff;
+    m_readOff = 0;
+}
+
+template< typename T, typename ForEachArg, size_t N, class Allocator >
+void circular_queue_mp_spill<T, ForEachArg, N, Allocator>::release()
+{
+    if (m_mapSize <= INITIAL_SPILL_SIZE) return;
+    munmap(m_map, m_mapSize);
+    m_map = nullptr;
+    m_mapSize = 0;
+    // If the file keeps its size, grow() reuses it.
+    const int truncated = ftruncate(m_fd, 0);
+    (void)truncated;
+}
+
+template< typename T, typename ForEachArg, size_t N, class Allocator >
+bool circular_queue_mp_spill<T, ForEachArg, N, Allocator>::spill(const T& val)
+{
+    std::lock_guard<std::mutex> lock(m_spillMutex);
+    if (m_fd < 0) return false;
+    if (m_writeOff + sizeof(T) > m_mapSize)
+    {
+        // Reuse the part of the file that the consumer has read already if that is
+        // at least half of it, or if the file cannot grow.
+        if (!m_readOff || m_readOff < m_mapSize / 2) grow();
+        if (m_writeOff + sizeof(T) > m_mapSize && m_readOff) compact();
+        if (m_writeOff + sizeof(T) > m_mapSize) return false;
+    }
+    memcpy(m_map + m_writeOff, &val, sizeof(T));
+    m_writeOff += sizeof(T);
+    m_spilling.store(true);
+    return true;
+}
+
+template< typename T, typename ForEachArg, size_t N, class Allocator >
+T circular_queue_mp_spill<T, ForEachArg, N, Allocator>::pop()
+{
+    if (base::available()) return base::pop();
+    if (!m_spilling.load()) return {};
+    // Elements that producers claimed in the ring buffer before spilling, but have not
+    // yet published, precede the spilled ones.
+    if (base::m_inPos_mp.load() != base::m_inPos.load()) return {};
+    if (base::available()) return base::pop();
+
+    std::lock_guard<std::mutex> lock(m_spillMutex);
+    if (m_readOff == m_writeOff)
+    {
+        m_spilling.store(false);
+        return {};
+    }
+    T val;
+    memcpy(&val, m_map + m_readOff, sizeof(T));
+    m_readOff += sizeof(T);
+    if (m_readOff == m_writeOff)
+    {
+        // Drained, the ring buffer takes over again, and the file is reused from its start,
+        // or truncated if it has grown.
+        m_readOff = 0;
+        m_writeOff = 0;
+        release();
+        m_spilling.store(false);
+    }
+    return val;
+}
+
+#endif
+
+#endif // __circular_queue_spill_h
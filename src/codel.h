@@ -0,0 +1,180 @@
+#pragma once
+/*
+codel.h - Sojourn time stamps and a CoDel active queue management policy.
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __codel_h
+#define __codel_h
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+#include <atomic>
+#include <stdint.h>
+#include <math.h>
+#if !defined(ARDUINO)
+#include <chrono>
+#endif
+
+/*!
+    @brief  Get a cheap monotonic time stamp in microseconds, for measuring sojourn times.
+            It wraps around after about 71 minutes, differences are valid up to that.
+*/
+inline uint32_t sojourn_now()
+{
+#if defined(ARDUINO)
+    return micros();
+#else
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+/*!
+    @brief  A queue element together with the time stamp of its push.
+*/
+template< typename T >
+struct sojourn_stamped
+{
+    T item;
+    uint32_t stamp;
+};
+
+/*!
+    @brief  A CoDel (controlled delay) active queue management policy, after RFC 8289.
+            The consumer reports the sojourn time of every dequeued element. Once sojourn
+            times have stayed above the target for a whole interval, the policy enters
+            its dropping state. Then it drops an element at intervals that shrink with the
+            square root of the number of drops, until a sojourn time falls below the target.
+            If rejecting, it drops nothing, but producers are to reject new elements while
+            in the dropping state.
+            The state is updated by a single consumer, producers may read dropping().
+*/
+class codel
+{
+public:
+    /*!
+        @param  target The acceptable standing sojourn time, in microseconds.
+        @param  interval The time in microseconds that sojourn times must stay above target
+                before dropping starts, on the order of a worst-case consumer round trip.
+        @param  rejecting Whether to reject new elements instead of dropping dequeued ones.
+    */
+    explicit codel(const uint32_t target = 5000, const uint32_t interval = 100000, const bool rejecting = false) :
+        m_target(target), m_interval(interval), m_rejecting(rejecting),
+        m_firstAbove(0), m_dropNext(0), m_count(0)
+    {
+        m_dropping.store(false);
+    }
+    /*!
+        @brief  Copy the parameters of another policy, starting from the initial state.
+    */
+    codel(const codel& other) : codel(other.m_target, other.m_interval, other.m_rejecting) {}
+    codel& operator=(const codel&) = delete;
+
+    /*!
+        @brief  Report the sojourn time of an element that the consumer just dequeued.
+        @param  sojourn The element's sojourn time in microseconds.
+        @param  now The current sojourn_now() time stamp.
+        @param  empty Whether the queue is empty after this element, which also ends dropping.
+        @return true if the consumer must drop the element.
+    */
+    bool should_drop(const uint32_t sojourn, const uint32_t now, const bool empty)
+    {
+        if (sojourn < m_target || empty)
+        {
+            m_firstAbove = 0;
+            m_dropping.store(false, std::memory_order_relaxed);
+            return false;
+        }
+        if (!m_dropping.load(std::memory_order_relaxed))
+        {
+            if (!m_firstAbove)
+            {
+                m_firstAbove = (now + m_interval) | 1;
+                return false;
+            }
+            if (before(now, m_firstAbove)) return false;
+            // Restart near the previous drop rate if dropping ended only recently.
+            m_count = m_count > 2 && before(now, m_dropNext + 16 * m_interval) ? m_count - 2 : 1;
+            m_dropping.store(true, std::memory_order_relaxed);
+        }
+        else if (before(now, m_dropNext))
+        {
+            return false;
+        }
+        else
+        {
+            ++m_count;
+        }
+        m_dropNext = now + static_cast<uint32_t>(m_interval / sqrtf(static_cast<float>(m_count)));
+        return !m_rejecting;
+    }
+
+    /*!
+        @brief  Test whether the policy is in its dropping state.
+    */
+    bool dropping() const
+    {
+        return m_dropping.load(std::memory_order_relaxed);
+    }
+
+    /*!
+        @brief  Test whether producers are to reject new elements.
+    */
+    bool rejecting() const
+    {
+        return m_rejecting && dropping();
+    }
+
+protected:
+    static bool before(const uint32_t a, const uint32_t b)
+    {
+        return static_cast<int32_t>(a - b) < 0;
+    }
+
+    const uint32_t m_target;
+    const uint32_t m_interval;
+    const bool m_rejecting;
+    uint32_t m_firstAbove;
+    uint32_t m_dropNext;
+    uint32_t m_count;
+    std::atomic<bool> m_dropping;
+};
+
+/*!
+    @brief  A queue management policy that never drops nor rejects, for queues that
+            only stamp their elements to report sojourn times, see codel.
+*/
+struct no_drop
+{
+    bool should_drop(const uint32_t, const uint32_t, const bool)
+    {
+        return false;
+    }
+    bool dropping() const
+    {
+        return false;
+    }
+    bool rejecting() const
+    {
+        return false;
+    }
+};
+
+#endif // __codel_h
@@ -0,0 +1,57 @@
+#pragma once
+/*
+contention.h - Counters of the contention in the retry loops of the lock-free containers.
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __contention_h
+#define __contention_h
+
+// Define GHOSTL_CONTENTION_STATS as 1 for counters of the contention between the producers
+// of each circular_queue_mp, and the users of each lfllist, see contention().
+#ifndef GHOSTL_CONTENTION_STATS
+#define GHOSTL_CONTENTION_STATS 0
+#endif
+
+#if GHOSTL_CONTENTION_STATS
+#include <atomic>
+#include <cstddef>
+
+namespace ghostl
+{
+    /// <summary>
+    /// Event counters of a container, indexed by the container's own enumeration
+    /// of its Events kinds of contention. Counting is relaxed, the counters are statistics only.
+    /// </summary>
+    template<size_t Events>
+    struct contention_counters
+    {
+        void count(const size_t event)
+        {
+            counters[event].fetch_add(1, std::memory_order_relaxed);
+        }
+        size_t operator[](const size_t event) const
+        {
+            return counters[event].load(std::memory_order_relaxed);
+        }
+    private:
+        std::atomic<size_t> counters[Events]{};
+    };
+}
+#endif
+
+#endif // __contention_h
@@ -22,13 +22,30 @@
 #define __LFLLIST_H
 
 #include "Delegate.h"
+#include "backoff.h"
+#include "contention.h"
 
 #include <atomic>
 #include <utility>
 
 namespace ghostl
 {
-    template<typename T, class Allocator, typename ForEachArg>
+#if GHOSTL_CONTENTION_STATS
+    /// <summary>
+    /// A snapshot of the contention counters of an lfllist.
+    /// </summary>
+    struct lfllist_contention
+    {
+        // The number of failed compare-exchanges while locking the neighbor of, or unlinking, a node.
+        size_t cas_failures;
+        // The number of try_remove() calls that found the node locked by another remover.
+        size_t remove_lock_collisions;
+        // The number of try_pop() calls that lost the pop guard to another popper.
+        size_t pop_guard_collisions;
+    };
+#endif
+
+    template<typename T, class Allocator, typename ForEachArg, class Backoff>
     struct lfllist;
 
     namespace detail {
@@ -40,14 +57,19 @@ namespace ghostl
             lfllist_node_type() = default;
             explicit lfllist_node_type(T&& _item) : item(std::move(_item)) {}
         private:
-            template<typename, class, typename> friend struct ghostl::lfllist;
+            template<typename, class, typename, class> friend struct ghostl::lfllist;
             std::atomic<node_type*> pred{ nullptr };
             std::atomic<node_type*> next{ nullptr };
             std::atomic<bool> remove_lock{ false };
         };
     };
 
-    template<typename T, class Allocator = std::allocator<detail::lfllist_node_type<T>>, typename ForEachArg = void>
+    /// <summary>
+    /// A lock free double-linked list. Operations that contend for the lock of a node
+    /// retry after the Backoff policy, see backoff.h.
+    /// </summary>
+    template<typename T, class Allocator = std::allocator<detail::lfllist_node_type<T>>, typename ForEachArg = void,
+        class Backoff = default_backoff>
     struct lfllist
     {
         using node_type = detail::lfllist_node_type<T>;
@@ -101,7 +123,7 @@ namespace ghostl
         /// <param name="node">A node (not nullptr) that must be a member of this list.</param>
         auto remove(node_type* const node) -> void
         {
-            while (!try_remove(node)) {}
+            for (Backoff backoff; !try_remove(node);) backoff();
         }
 
         /// <summary>
@@ -115,9 +137,14 @@ namespace ghostl
         auto try_remove(node_type* const node) -> bool
         {
             auto _false = false;
-            if (!node->remove_lock.compare_exchange_strong(_false, true)) { return false; }
+            if (!node->remove_lock.compare_exchange_strong(_false, true))
+            {
+                contended(contention_remove_lock);
+                return false;
+            }
             node_type* next = nullptr;
             node_type* pred = nullptr;
+            Backoff backoff;
             for (;;)
             {
                 next = node->next.load();
@@ -131,6 +158,8 @@ namespace ghostl
                 {
                     _false = false;
                 }
+                contended(contention_cas_failure);
+                backoff();
             }
             for (;;)
             {
@@ -139,7 +168,9 @@ namespace ghostl
                 auto _node = node;
                 if (!pred && !first.compare_exchange_strong(_node, next))
                 {
-                    while (node->pred.compare_exchange_strong(pred, pred)) {}
+                    contended(contention_cas_failure);
+                    // Wait for the concurrent push that made first differ from node to link it.
+                    for (Backoff wait; node->pred.compare_exchange_strong(pred, pred);) wait();
                     continue;
                 }
                 break;
@@ -160,7 +191,7 @@ namespace ghostl
         /// <param name="to_erase">An item (not nullptr) that must be a member of this list.</param>
         auto erase(node_type* const to_erase) -> void
         {
-            while (!try_erase(to_erase)) {}
+            for (Backoff backoff; !try_erase(to_erase);) backoff();
         }
 
         /// <summary>
@@ -216,7 +247,11 @@ namespace ghostl
         [[nodiscard]] auto try_pop(node_type*& node) -> bool
         {
             auto _false = false;
-            if (!pop_guard.compare_exchange_strong(_false, true)) { return false; }
+            if (!pop_guard.compare_exchange_strong(_false, true))
+            {
+                contended(contention_pop_guard);
+                return false;
+            }
             auto has_node = false;
             if (nullptr != (node = back()))
             {
@@ -239,17 +274,50 @@ namespace ghostl
         void for_each(Delegate<void(T&&), ForEachArg> fn)
 #endif
         {
-            while (back())
+            for (Backoff backoff; back();)
             {
                 if (T item; try_pop(item)) fn(std::move(item));
+                else backoff();
             }
         };
 
+#if GHOSTL_CONTENTION_STATS
+        /// <summary>
+        /// Get a snapshot of the contention counters of this list.
+        /// </summary>
+        auto contention() const -> lfllist_contention
+        {
+            lfllist_contention snapshot;
+            snapshot.cas_failures = contention_stats[contention_cas_failure];
+            snapshot.remove_lock_collisions = contention_stats[contention_remove_lock];
+            snapshot.pop_guard_collisions = contention_stats[contention_pop_guard];
+            return snapshot;
+        }
+#endif
+
     private:
+        enum contention_event
+        {
+            contention_cas_failure,
+            contention_remove_lock,
+            contention_pop_guard,
+            contention_events
+        };
+
+        auto contended([[maybe_unused]] const contention_event event) -> void
+        {
+#if GHOSTL_CONTENTION_STATS
+            contention_stats.count(event);
+#endif
+        }
+
         Allocator alloc;
         node_type last_sentinel;
         std::atomic<node_type*> first = &last_sentinel;
         std::atomic<bool> pop_guard{ false };
+#if GHOSTL_CONTENTION_STATS
+        contention_counters<contention_events> contention_stats;
+#endif
     };
 }
 
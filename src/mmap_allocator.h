@@ -0,0 +1,115 @@
+#pragma once
+/*
+mmap_allocator.h - An allocator of page-mapped memory, for large ring buffers.
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __mmap_allocator_h
+#define __mmap_allocator_h
+
+#if !defined(ARDUINO) && (defined(__unix__) || defined(__APPLE__))
+
+#include <cstddef>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*!
+    @brief  An allocator that maps each allocation as private anonymous memory, for example as
+            the Allocator of a large circular_queue.
+            If HugePages is true, the allocation is rounded up to 2 MiB and mapped with
+            explicit huge pages (MAP_HUGETLB) if the system has them reserved, else with regular
+            pages that are advised for transparent huge pages (MADV_HUGEPAGE). Either way,
+            fewer TLB entries cover the mapping.
+            If Prefault is true, all pages are faulted in on allocation, instead of on first touch.
+*/
+template< typename T, bool HugePages = true, bool Prefault = false >
+struct mmap_allocator
+{
+    using value_type = T;
+
+    template< typename U >
+    struct rebind
+    {
+        using other = mmap_allocator<U, HugePages, Prefault>;
+    };
+
+    mmap_allocator() = default;
+    template< typename U >
+    mmap_allocator(const mmap_allocator<U, HugePages, Prefault>&) {}
+
+    T* allocate(const size_t n)
+    {
+        const size_t size = mapping_size(n);
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#if defined(MAP_POPULATE)
+        if (Prefault) flags |= MAP_POPULATE;
+#endif
+        void* p = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+        if (HugePages) p = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+#endif
+        if (MAP_FAILED == p)
+        {
+            p = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+            if (MAP_FAILED == p) throw std::bad_alloc();
+#if defined(MADV_HUGEPAGE)
+            if (HugePages) madvise(p, size, MADV_HUGEPAGE);
+#endif
+#if !defined(MAP_POPULATE)
+            // Touch every page, as the mapping cannot be populated on creation.
+            if (Prefault) for (size_t i = 0; i < size; i += page_size()) static_cast<volatile char*>(p)[i] = 0;
+#endif
+        }
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* const p, const size_t n)
+    {
+        munmap(p, mapping_size(n));
+    }
+
+    static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+protected:
+    static size_t page_size()
+    {
+        return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    }
+
+    static size_t mapping_size(const size_t n)
+    {
+        const size_t granule = HugePages ? HUGE_PAGE_SIZE : page_size();
+        return (n * sizeof(T) + granule - 1) / granule * granule;
+    }
+};
+
+template< typename T, typename U, bool HugePages, bool Prefault >
+inline bool operator==(const mmap_allocator<T, HugePages, Prefault>&, const mmap_allocator<U, HugePages, Prefault>&)
+{
+    return true;
+}
+
+template< typename T, typename U, bool HugePages, bool Prefault >
+inline bool operator!=(const mmap_allocator<T, HugePages, Prefault>&, const mmap_allocator<U, HugePages, Prefault>&)
+{
+    return false;
+}
+
+#endif
+
+#endif // __mmap_allocator_h
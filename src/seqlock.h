@@ -0,0 +1,103 @@
+#pragma once
+/*
+seqlock.h - Implementation of a lock-free latest-value mailbox based on a sequence lock.
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __seqlock_h
+#define __seqlock_h
+
+#include "circular_queue.h"
+#include "backoff.h"
+
+/*!
+    @brief  Instance class for a single-writer, multi-reader mailbox that holds only the latest value.
+            The writer never waits, it overwrites the value in place. Readers copy the value and
+            retry if the writer changed it meanwhile, so they always get the newest complete value.
+            For this to be safe, T must be trivially copyable; for larger objects, see triple_buffer.
+            Readers that collide with a store retry after the Backoff policy, see backoff.h.
+*/
+template< typename T, class Backoff = ghostl::default_backoff >
+class seqlock
+{
+#if defined(ESP8266) || defined(ESP32) || !defined(ARDUINO)
+    static_assert(std::is_trivially_copyable<T>::value, "seqlock requires a trivially copyable T");
+#endif
+
+public:
+    seqlock() : m_val()
+    {
+        m_seq.store(0);
+    }
+    explicit seqlock(const T& val) : m_val(val)
+    {
+        m_seq.store(0);
+    }
+    seqlock(const seqlock&) = delete;
+    seqlock& operator=(const seqlock&) = delete;
+
+    /*!
+        @brief  Replace the value. Only one writer may store at a time.
+    */
+    void IRAM_ATTR store(const T& val)
+    {
+        const auto seq = m_seq.load(std::memory_order_relaxed);
+        m_seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_val = val;
+        m_seq.store(seq + 2, std::memory_order_release);
+    }
+
+    /*!
+        @brief  Try once to copy the value, without retrying if the writer interferes.
+        @return true if val received a complete value, false if a store was in progress.
+    */
+    bool try_load(T& val) const
+    {
+        const auto seq = m_seq.load(std::memory_order_acquire);
+        if (seq & 1) return false;
+        const T copy = m_val;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_seq.load(std::memory_order_relaxed) != seq) return false;
+        val = copy;
+        return true;
+    }
+
+    /*!
+        @brief  Get a copy of the newest complete value.
+    */
+    T load() const
+    {
+        T val;
+        for (Backoff backoff; !try_load(val); backoff()) {}
+        return val;
+    }
+
+    /*!
+        @brief  Get the number of stores so far, for readers to tell whether the value changed.
+    */
+    size_t version() const
+    {
+        return m_seq.load(std::memory_order_acquire) / 2;
+    }
+
+protected:
+    std::atomic<size_t> m_seq;
+    T m_val;
+};
+
+#endif // __seqlock_h
@@ -21,6 +21,9 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <atomic>
 #include <memory>
 #include <coroutine>
+#include <utility>
+
+#include "backoff.h"
 
 #if defined(__GNUC__)
 #undef ALWAYS_INLINE_ATTR
@@ -31,7 +34,12 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 namespace ghostl
 {
-template<typename T = void>
+/// <summary>
+/// The producer side of a value, or a completion without value if T is void, that a coroutine
+/// can co_await by token(). set_value() retries after the Backoff policy, see backoff.h,
+/// while an awaiter is in the midst of suspending.
+/// </summary>
+template<typename T = void, class Backoff = default_backoff>
 struct task_completion_source
 {
     task_completion_source() = default;
@@ -62,7 +70,8 @@ struct task_completion_source
             return;
         state->value = std::make_shared<T>(std::move(val));
         std::atomic_thread_fence(std::memory_order_release);
-        for (bool expect{false}; !state->ready.compare_exchange_weak(expect, true); expect = false) {}
+        Backoff backoff;
+        for (bool expect{false}; !state->ready.compare_exchange_weak(expect, true); expect = false) backoff();
         if (auto handle = state->coroutine.load(); handle && !handle.done()) { handle.resume(); }
     }
     auto set_value(const T& val) const -> void ALWAYS_INLINE_ATTR
@@ -106,8 +115,8 @@ private:
     std::shared_ptr<state_type> state{std::make_shared<state_type>()};
 };
 
-template<>
-struct task_completion_source<void>
+template<class Backoff>
+struct task_completion_source<void, Backoff>
 {
     task_completion_source() = default;
     task_completion_source(const task_completion_source& other) noexcept : state(other.state) { }
@@ -136,7 +145,8 @@ struct task_completion_source<void>
         for (bool expect{false}; !state->is_set.compare_exchange_strong(expect, true);)
             return;
         std::atomic_thread_fence(std::memory_order_release);
-        for (bool expect{false}; !state->ready.compare_exchange_weak(expect, true); expect = false) {}
+        Backoff backoff;
+        for (bool expect{false}; !state->ready.compare_exchange_weak(expect, true); expect = false) backoff();
         if (auto handle = state->coroutine.load(); handle && !handle.done()) { handle.resume(); }
     }
     [[nodiscard]] auto token() const { return awaiter(state); }
@@ -0,0 +1,120 @@
+#pragma once
+/*
+triple_buffer.h - Implementation of a lock-free latest-value triple buffer.
+Copyright (c) 2019 Dirk O. Kaar. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __triple_buffer_h
+#define __triple_buffer_h
+
+#include "circular_queue.h"
+
+/*!
+    @brief  Instance class for a single-writer, single-reader triple buffer that passes on only
+            the latest value. The writer fills its back buffer in place and publishes it by
+            swapping it with the middle buffer, the reader takes the middle buffer in exchange
+            for its front buffer. Neither side ever waits or copies, so T may be a large
+            object; for small trivially copyable values, see seqlock.
+*/
+template< typename T >
+class triple_buffer
+{
+public:
+    triple_buffer()
+    {
+        m_middle.store(1);
+        m_back = 0;
+        m_front = 2;
+    }
+    triple_buffer(const triple_buffer&) = delete;
+    triple_buffer& operator=(const triple_buffer&) = delete;
+
+    /*!
+        @brief  Get the writer's back buffer, for filling in the next value in place.
+                Holds an arbitrary older value.
+    */
+    T& back()
+    {
+        return m_buffers[m_back].val;
+    }
+
+    /*!
+        @brief  Publish the back buffer as the newest value, replacing a previous
+                value that the reader has not taken yet.
+    */
+    void IRAM_ATTR publish()
+    {
+        m_back = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    /*!
+        @brief  Publish a copy of the parameter as the newest value.
+    */
+    void write(const T& val)
+    {
+        back() = val;
+        publish();
+    }
+
+    /*!
+        @brief  Take the newest value into the reader's front buffer, if one was published
+                since the last update.
+        @return true if the front buffer was replaced with a newer value.
+    */
+    bool update()
+    {
+        if (!(m_middle.load(std::memory_order_relaxed) & FRESH)) return false;
+        m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    /*!
+        @brief  Get the reader's front buffer, holding the value of the last update().
+    */
+    const T& front() const
+    {
+        return m_buffers[m_front].val;
+    }
+
+    /*!
+        @brief  Update and get the newest value.
+    */
+    const T& read()
+    {
+        update();
+        return front();
+    }
+
+protected:
+    static constexpr uint8_t INDEX = 3;
+    static constexpr uint8_t FRESH = 4;
+
+    struct alignas(GHOSTL_CACHELINE_SIZE) buffer
+    {
+        T val;
+    };
+
+    buffer m_buffers[3];
+    // The middle buffer's index, and whether it holds a value the reader has not taken.
+    alignas(GHOSTL_CACHELINE_SIZE) std::atomic<uint8_t> m_middle;
+    // Owned by the writer.
+    alignas(GHOSTL_CACHELINE_SIZE) uint8_t m_back;
+    // Owned by the reader.
+    alignas(GHOSTL_CACHELINE_SIZE) uint8_t m_front;
+};
+
+#endif // __triple_buffer_h